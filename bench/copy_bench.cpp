@@ -0,0 +1,309 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Times copying a set of song-sized files to a device folder: a plain
+// CopyFile loop, as syncplaylists did before the copier module, then
+// copier::copyFiles with 1, 2, 4 and 8 copies at a time for each backend.
+// Windows only, like the copier.
+//
+//   copy_bench [--order] <source folder> <device folder> [files [copies...]]
+//
+// The source folder is filled with files (default 200) of 3 to 12 MB the
+// first time, in artist\album folders of 12; they're reused after that.
+// The device folder is emptied of the copies after each run.  To time a
+// FAT32 device without one, create and attach a VHD in Disk Management,
+// format it FAT32 and use its drive.  The source files are in the system
+// cache after the first run, so the times are of writing the device,
+// which is what a sync is bound by.
+//
+// --order times each --order instead, with the blocks backend unbuffered
+// so every run reads the source from disk, and reports how fragmented the
+// copies are.  "none" is the order of the library's file map, and
+// "playlist" is one playlist of every song in shuffled order.  Put the
+// source folder on a spinning disk to see the seeks.
+
+#include <windows.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <unordered_map>
+#include <cstdint>
+#include <cstdlib>
+#include <cwchar>
+#include <utility>
+
+#include "common.h"
+#include "util.h"
+#include "workqueue.h"
+#include "manifest.h"
+#include "disk.h"
+#include "copier.h"
+
+using namespace std;
+using namespace syncplaylists;
+using namespace syncplaylists::common;
+using namespace syncplaylists::util;
+
+static const unsigned long long min_size = 3 * 1024 * 1024;
+static const unsigned long long max_size = 12 * 1024 * 1024;
+
+static wstring withSlash(wstring dir)
+{
+    if (!dir.empty() && dir.back() != L'\\')
+        dir.push_back(L'\\');
+    return dir;
+}
+
+// creates the source files that don't exist yet, with sizes that vary
+// the same way from run to run, and adds them to library
+static void makeSources(const wstring& srcdir, size_t nfiles, Library& library)
+{
+    vector<char> block(1024 * 1024);
+    unsigned seed = 12345;
+    for (auto& c : block) {
+        seed = seed * 1103515245 + 12345;
+        c = static_cast<char>(seed >> 16);
+    }
+
+    for (size_t i = 0; i < nfiles; ++i) {
+        seed = seed * 1103515245 + 12345;
+        auto size = min_size + (seed >> 8) % (max_size - min_size);
+
+        wchar_t name[64];
+        swprintf(name, 64, L"artist%03zu", i / 120);
+        wstring path = srcdir + name;
+        ::CreateDirectory(path.c_str(), nullptr);
+        swprintf(name, 64, L"\\album%04zu", i / 12);
+        path += name;
+        ::CreateDirectory(path.c_str(), nullptr);
+        swprintf(name, 64, L"\\song%05zu.mp3", i);
+        path += name;
+
+        WIN32_FILE_ATTRIBUTE_DATA attrs;
+        if (!::GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attrs)
+            || ((static_cast<unsigned long long>(attrs.nFileSizeHigh) << 32) | attrs.nFileSizeLow) != size) {
+            HANDLE h = ::CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            throwLastErrorIfFalse(h != INVALID_HANDLE_VALUE, [&] { return L"unable to create " + path; });
+            for (auto left = size; left > 0; ) {
+                DWORD n = static_cast<DWORD>(left < block.size() ? left : block.size());
+                DWORD written = 0;
+                BOOL ok = ::WriteFile(h, block.data(), n, &written, nullptr);
+                if (!ok || written != n) {
+                    ::CloseHandle(h);
+                    throwLastErrorIfFalse(FALSE, [&] { return L"unable to write " + path; });
+                }
+                left -= n;
+            }
+            ::CloseHandle(h);
+            throwLastErrorIfFalse(::GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attrs) != FALSE, [&] { return L"unable to stat " + path; });
+        }
+
+        auto& track = library.addTrack(static_cast<long>(i + 1), path);
+        track.size = size;
+        track.lastWrite = (static_cast<unsigned long long>(attrs.ftLastWriteTime.dwHighDateTime) << 32) | attrs.ftLastWriteTime.dwLowDateTime;
+    }
+}
+
+static void removeCopies(const wstring& dstdir, const Library& library)
+{
+    for (auto const& track : library.tracks) {
+        ::DeleteFile((dstdir + wstring(track.filename)).c_str());
+    }
+}
+
+static double totalMB(const Library& library)
+{
+    unsigned long long total = 0;
+    for (auto const& track : library.tracks)
+        total += track.size;
+    return total / (1024.0 * 1024.0);
+}
+
+static void report(const wchar_t* what, double seconds, double mb)
+{
+    wchar_t buf[128];
+    swprintf(buf, 128, L"%-22s %8.2f s %8.1f MB/s", what, seconds, mb / seconds);
+    printOut(buf);
+}
+
+static double copyEngine(const wstring& dstdir, const Library& library, const Options& opts,
+    const vector<TrackId>& tocopy)
+{
+    manifest::Entries_t entries;
+    Stopwatch sw;
+    copier::copyFiles(dstdir, library, tocopy, opts, entries);
+    return sw.seconds();
+}
+
+// the loop copyFiles had before the copier module
+static double copySerial(const wstring& dstdir, const Library& library)
+{
+    wstring src;
+    Stopwatch sw;
+    for (auto const& track : library.tracks) {
+        getLocation(track, src);
+        wstring dst = dstdir + wstring(track.filename);
+        throwLastErrorIfFalse(::CopyFile(src.c_str(), dst.c_str(), FALSE) != FALSE, [&] { return L"failed to copy " + dst; });
+    }
+    return sw.seconds();
+}
+
+static double copyEngine(const wstring& dstdir, const Library& library, const Options& opts)
+{
+    vector<TrackId> tocopy;
+    for (auto const& track : library.tracks)
+        tocopy.push_back(track.id);
+    return copyEngine(dstdir, library, opts, tocopy);
+}
+
+static void compareBackends(const wstring& dstdir, const Library& library, const vector<unsigned>& copies, double mb)
+{
+    // warms the cache with the source files, and times the old loop
+    removeCopies(dstdir, library);
+    copySerial(dstdir, library);
+    removeCopies(dstdir, library);
+    report(L"serial CopyFile", copySerial(dstdir, library), mb);
+    removeCopies(dstdir, library);
+
+    static const struct { CopyBackend backend; const wchar_t* name; } backends[] = {
+        { CopyBackend::CopyFileApi, L"copyfile" },
+        { CopyBackend::CopyFile2, L"copyfile2" },
+        { CopyBackend::Blocks, L"blocks" },
+    };
+
+    wchar_t buf[128];
+    for (auto const& b : backends) {
+        for (auto n : copies) {
+            Options opts;
+            opts.copyBackend = b.backend;
+            opts.copies = n;
+            auto seconds = copyEngine(dstdir, library, opts);
+            removeCopies(dstdir, library);
+
+            swprintf(buf, 128, L"%s, %u copies", b.name, n);
+            report(buf, seconds, mb);
+        }
+    }
+}
+
+static void compareOrders(const wstring& dstdir, Library& library, const vector<unsigned>& copies, double mb)
+{
+    vector<TrackId> shuffled;
+    for (auto const& track : library.tracks)
+        shuffled.push_back(track.id);
+    unsigned seed = 54321;
+    for (size_t i = shuffled.size(); i > 1; --i) {
+        seed = seed * 1103515245 + 12345;
+        swap(shuffled[i - 1], shuffled[(seed >> 8) % i]);
+    }
+    library.playlists.emplace(L"bench", shuffled);
+    vector<wstring> playlistOrder = { L"bench" };
+
+    static const struct { CopyOrder order; const wchar_t* name; } orders[] = {
+        { CopyOrder::None, L"none" },
+        { CopyOrder::Path, L"path" },
+        { CopyOrder::Largest, L"largest" },
+        { CopyOrder::Playlist, L"playlist" },
+    };
+
+    removeCopies(dstdir, library);
+
+    wchar_t buf[128];
+    for (auto const& o : orders) {
+        for (auto n : copies) {
+            Options opts;
+            opts.copyBackend = CopyBackend::Blocks;
+            opts.unbuffered = true;
+            opts.copyOrder = o.order;
+            opts.copies = n;
+
+            vector<TrackId> tocopy;
+            for (auto const& it : library.files)
+                tocopy.push_back(it.second);
+            copier::orderCopies(opts, playlistOrder, library, tocopy);
+
+            auto seconds = copyEngine(dstdir, library, opts, tocopy);
+            swprintf(buf, 128, L"%s, %u copies", o.name, n);
+            report(buf, seconds, mb);
+            disk::reportExtents(dstdir, library, opts.copyBackend);
+            removeCopies(dstdir, library);
+        }
+    }
+}
+
+int wmain(int argc, wchar_t* argv[])
+{
+    int argi = 1;
+    bool order = argi < argc && wstring(argv[argi]) == L"--order";
+    if (order)
+        ++argi;
+
+    if (argc - argi < 2) {
+        printErr(L"usage: copy_bench [--order] <source folder> <device folder> [files [copies...]]");
+        return 1;
+    }
+
+    try {
+        auto srcdir = withSlash(argv[argi]);
+        auto dstdir = withSlash(argv[argi + 1]);
+        argi += 2;
+        size_t nfiles = argi < argc ? wcstoul(argv[argi++], nullptr, 10) : 200;
+        vector<unsigned> copies;
+        for (; argi < argc; ++argi)
+            copies.push_back(static_cast<unsigned>(wcstoul(argv[argi], nullptr, 10)));
+        if (copies.empty())
+            copies = order ? vector<unsigned>{ 1, 4 } : vector<unsigned>{ 1, 2, 4, 8 };
+
+        Library library;
+        makeSources(srcdir, nfiles, library);
+        auto mb = totalMB(library);
+
+        wchar_t buf[128];
+        swprintf(buf, 128, L"%zu files, %.0f MB", library.tracks.size(), mb);
+        printOut(buf);
+
+        if (order)
+            compareOrders(dstdir, library, copies, mb);
+        else
+            compareBackends(dstdir, library, copies, mb);
+    } catch (const Error& e) {
+        printErr(e.message());
+        return 1;
+    }
+
+    return 0;
+}
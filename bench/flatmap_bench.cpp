@@ -0,0 +1,152 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Times util::FlatMap against std::unordered_map with filename-like keys:
+// building the map, then looking up every key in shuffled order with half
+// of them changed so they miss, as the device and library indexes do.
+//
+//   flatmap_bench [entries...]
+//
+// The default is 10k, 100k and 1M entries.  Keys are views of about 50
+// characters, hashed with std::hash<wstring_view>.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "flatmap.h"
+
+using namespace std;
+using namespace syncplaylists;
+
+typedef hash<wstring_view> Hash;
+
+// the best of three runs of f, in seconds, with reset run between them
+template <typename F, typename R>
+static double best(F f, R reset)
+{
+    double least = 0;
+    for (int run = 0; run < 3; ++run) {
+        reset();
+        auto start = chrono::steady_clock::now();
+        f();
+        double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (run == 0 || t < least)
+            least = t;
+    }
+    return least;
+}
+
+template <typename F>
+static double best(F f)
+{
+    return best(f, [] {});
+}
+
+int main(int argc, char* argv[])
+{
+    vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i) {
+        sizes.push_back(static_cast<size_t>(atol(argv[i])));
+    }
+    if (sizes.empty())
+        sizes = { 10000, 100000, 1000000 };
+
+    printf("%10s %24s %24s\n", "entries", "build (unordered/flat)", "lookup (unordered/flat)");
+
+    mt19937 rng(5);
+
+    for (auto n : sizes) {
+        vector<wstring> names;
+        names.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            names.push_back(L"Some Artist Name - " + to_wstring(rng()) + L" Track Title " + to_wstring(i) + L".m4a");
+        }
+
+        vector<wstring> probes(names);
+        shuffle(probes.begin(), probes.end(), rng);
+        for (size_t i = 0; i < n / 2; ++i) {
+            probes[i][0] = L'X';
+        }
+
+        typedef unordered_map<wstring_view, unsigned, Hash> Unordered_t;
+        typedef util::FlatMap<wstring_view, unsigned, Hash, equal_to<> > Flat_t;
+
+        // each run builds a new map; freeing the last one isn't timed
+        Unordered_t um;
+        auto umBuild = best([&] {
+            Unordered_t m;
+            for (size_t i = 0; i < n; ++i)
+                m.emplace(names[i], static_cast<unsigned>(i));
+            swap(m, um);
+        }, [&] { um = Unordered_t(); });
+
+        Flat_t fm;
+        auto fmBuild = best([&] {
+            Flat_t m;
+            for (size_t i = 0; i < n; ++i)
+                m.emplace(wstring_view(names[i]), static_cast<unsigned>(i));
+            swap(m, fm);
+        }, [&] { fm = Flat_t(); });
+
+        size_t umHits = 0, fmHits = 0;
+        auto umLookup = best([&] {
+            umHits = 0;
+            for (auto const& p : probes)
+                umHits += um.find(p) != um.end();
+        });
+        auto fmLookup = best([&] {
+            fmHits = 0;
+            for (auto const& p : probes)
+                fmHits += fm.find(wstring_view(p)) != fm.end();
+        });
+
+        if (umHits != fmHits || fm.size() != um.size()) {
+            fprintf(stderr, "%zu entries: the maps disagree\n", n);
+            return 1;
+        }
+
+        printf("%10zu %11.1f / %6.1f ms %11.0f / %6.0f ns\n", n,
+            umBuild * 1e3, fmBuild * 1e3, umLookup * 1e9 / n, fmLookup * 1e9 / n);
+    }
+
+    printf("the best of three runs; lookups are per key, half of them missing\n");
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Times the iTunes Library XML parser on synthetic exports: streamed from
+// a file on one thread, parsed in memory on one thread, and split between
+// threads.
+//
+//   plist_bench [threads [tracks...]]
+//
+// The default is one thread per core and 50k, 200k and 1M tracks.  Each
+// track has the keys a real export has, about 700 bytes of XML.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <exception>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+
+#include "plist.h"
+
+using namespace std;
+using namespace syncplaylists;
+
+static const int playlists = 40;
+static const int playlist_size = 500;
+
+static void generate(size_t ntracks, string& xml)
+{
+    xml.clear();
+    xml.reserve(ntracks * 800);
+
+    xml += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!DOCTYPE plist PUBLIC \"-//Apple Computer//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+        "<plist version=\"1.0\">\n<dict>\n"
+        "\t<key>Major Version</key><integer>1</integer>\n"
+        "\t<key>Tracks</key>\n\t<dict>\n";
+
+    char buf[2048];
+    for (size_t i = 0; i < ntracks; ++i) {
+        auto id = 1000 + i;
+        auto artist = i / 120;
+        auto album = i / 12;
+        auto number = i % 12 + 1;
+        snprintf(buf, sizeof(buf),
+            "\t\t<key>%zu</key>\n"
+            "\t\t<dict>\n"
+            "\t\t\t<key>Track ID</key><integer>%zu</integer>\n"
+            "\t\t\t<key>Name</key><string>Song Title Number %zu &amp; Friends</string>\n"
+            "\t\t\t<key>Artist</key><string>Artist Name %zu</string>\n"
+            "\t\t\t<key>Album</key><string>Album Title %zu</string>\n"
+            "\t\t\t<key>Kind</key><string>AAC audio file</string>\n"
+            "\t\t\t<key>Size</key><integer>%zu</integer>\n"
+            "\t\t\t<key>Total Time</key><integer>%zu</integer>\n"
+            "\t\t\t<key>Track Number</key><integer>%zu</integer>\n"
+            "\t\t\t<key>Date Modified</key><date>2020-11-28T18:22:01Z</date>\n"
+            "\t\t\t<key>Date Added</key><date>2020-11-28T18:22:01Z</date>\n"
+            "\t\t\t<key>Persistent ID</key><string>%016zX</string>\n"
+            "\t\t\t<key>Track Type</key><string>File</string>\n"
+            "\t\t\t<key>Location</key><string>file://localhost/C:/Users/someone/Music/iTunes/iTunes%%20Media/Music/"
+            "Artist%%20Name%%20%zu/Album%%20Title%%20%zu/%02zu%%20Song%%20Title%%20Number%%20%zu.m4a</string>\n"
+            "\t\t</dict>\n",
+            id, id, i, artist, album, 3000000 + i, 200000 + i, number, id,
+            artist, album, number, i);
+        xml += buf;
+    }
+
+    xml += "\t</dict>\n\t<key>Playlists</key>\n\t<array>\n";
+
+    // the same pseudo-random tracks every run
+    unsigned long long seed = 1;
+    for (int p = 0; p < playlists; ++p) {
+        snprintf(buf, sizeof(buf),
+            "\t\t<dict>\n"
+            "\t\t\t<key>Name</key><string>Playlist %d</string>\n"
+            "\t\t\t<key>Playlist ID</key><integer>%d</integer>\n"
+            "\t\t\t<key>Playlist Items</key>\n"
+            "\t\t\t<array>\n", p, p);
+        xml += buf;
+        for (int k = 0; k < playlist_size; ++k) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            snprintf(buf, sizeof(buf),
+                "\t\t\t\t<dict>\n\t\t\t\t\t<key>Track ID</key><integer>%zu</integer>\n\t\t\t\t</dict>\n",
+                static_cast<size_t>(1000 + (seed >> 33) % ntracks));
+            xml += buf;
+        }
+        xml += "\t\t\t</array>\n\t\t</dict>\n";
+    }
+
+    xml += "\t</array>\n</dict>\n</plist>\n";
+}
+
+// the best of three runs, in seconds
+template <typename F>
+static double best(F f)
+{
+    double least = 0;
+    for (int run = 0; run < 3; ++run) {
+        auto start = chrono::steady_clock::now();
+        f();
+        double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (run == 0 || t < least)
+            least = t;
+    }
+    return least;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned threads = argc > 1 ? static_cast<unsigned>(atoi(argv[1])) : thread::hardware_concurrency();
+    if (threads < 2)
+        threads = 2;
+
+    vector<size_t> sizes;
+    for (int i = 2; i < argc; ++i) {
+        sizes.push_back(static_cast<size_t>(atol(argv[i])));
+    }
+    if (sizes.empty())
+        sizes = { 50000, 200000, 1000000 };
+
+    // a quarter of the playlists are synced
+    vector<wstring> wanted;
+    for (int p = 0; p < playlists; p += 4) {
+        wanted.push_back(L"Playlist " + to_wstring(p));
+    }
+
+    printf("%10s %10s %12s %12s %12s\n", "tracks", "MB", "stream", "memory", "threads");
+
+    try {
+        string xml;
+        for (auto ntracks : sizes) {
+            generate(ntracks, xml);
+
+            unique_ptr<FILE, int (*)(FILE*)> fl(tmpfile(), fclose);
+            if (!fl || fwrite(xml.data(), 1, xml.size(), fl.get()) != xml.size()) {
+                fprintf(stderr, "can't write a temporary file\n");
+                return 1;
+            }
+
+            auto stream = best([&] {
+                rewind(fl.get());
+                plist::Selection selection;
+                plist::parse(fl.get(), L"stream", wanted, selection);
+            });
+
+            auto memory = best([&] {
+                plist::Selection selection;
+                plist::parse(xml, 1, L"memory", wanted, selection);
+            });
+
+            auto parallel = best([&] {
+                plist::Selection selection;
+                plist::parse(xml, threads, L"threads", wanted, selection);
+            });
+
+            printf("%10zu %10.0f %10.3f s %10.3f s %10.3f s\n", ntracks, xml.size() / 1e6, stream, memory, parallel);
+        }
+    } catch (const exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    printf("threads: %u\n", threads);
+
+    return 0;
+}
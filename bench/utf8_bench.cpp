@@ -0,0 +1,197 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Times utf8::append against a plain one-character-at-a-time encoder, and
+// on Windows against WideCharToMultiByte, which it replaced, converting
+// song filenames into a reused buffer the way renderPlaylist does.
+//
+//   utf8_bench [filenames]
+//
+// The default is 200k filenames in each of three sets: all ASCII, Latin
+// with an accented letter or two, and Japanese.
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "utf8.h"
+
+using namespace std;
+using namespace syncplaylists;
+
+static const bool wide_is_utf16 = sizeof(wchar_t) == 2;
+
+// what a straightforward encoder does, without the ASCII fast path
+static void appendPlain(wstring_view s, vector<char>& out)
+{
+    for (size_t i = 0; i < s.length(); ++i) {
+        auto c = static_cast<unsigned long>(s[i]);
+        if (wide_is_utf16) {
+            c &= 0xffff;
+            if (c >= 0xd800 && c <= 0xdbff && i + 1 < s.length()) {
+                auto low = static_cast<unsigned long>(s[i + 1]) & 0xffff;
+                if (low >= 0xdc00 && low <= 0xdfff) {
+                    c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                    ++i;
+                }
+            }
+        }
+        if ((c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff)
+            c = 0xfffd;
+
+        if (c < 0x80) {
+            out.push_back(static_cast<char>(c));
+        } else if (c < 0x800) {
+            out.push_back(static_cast<char>(0xc0 | (c >> 6)));
+            out.push_back(static_cast<char>(0x80 | (c & 0x3f)));
+        } else if (c < 0x10000) {
+            out.push_back(static_cast<char>(0xe0 | (c >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3f)));
+            out.push_back(static_cast<char>(0x80 | (c & 0x3f)));
+        } else {
+            out.push_back(static_cast<char>(0xf0 | (c >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((c >> 12) & 0x3f)));
+            out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3f)));
+            out.push_back(static_cast<char>(0x80 | (c & 0x3f)));
+        }
+    }
+}
+
+#ifdef _WIN32
+// the old appendUtf8: a length query, then the conversion in place
+static void appendWin32(wstring_view s, vector<char>& out)
+{
+    auto n = ::WideCharToMultiByte(CP_UTF8, 0, s.data(), static_cast<int>(s.length()), nullptr, 0, nullptr, nullptr);
+    auto at = out.size();
+    out.resize(at + n);
+    ::WideCharToMultiByte(CP_UTF8, 0, s.data(), static_cast<int>(s.length()), &out[at], n, nullptr, nullptr);
+}
+#endif
+
+// filenames like iTunes gives them, built from the words of one set
+static vector<wstring> makeNames(size_t count, const vector<wstring>& words)
+{
+    vector<wstring> names;
+    names.reserve(count);
+    unsigned seed = 1;
+    for (size_t i = 0; i < count; ++i) {
+        wchar_t number[8];
+        swprintf(number, 8, L"%02zu ", i % 15 + 1);
+        wstring name = number;
+        for (int w = 0; w < 4; ++w) {
+            seed = seed * 1103515245 + 12345;
+            if (w > 0)
+                name += L' ';
+            name += words[(seed >> 8) % words.size()];
+        }
+        name += L".m4a";
+        names.push_back(name);
+    }
+    return names;
+}
+
+// the best of three runs, in seconds, and the bytes it produced
+template <typename F>
+static double best(const vector<wstring>& names, F append, size_t& bytes)
+{
+    size_t room = 0;
+    for (auto const& name : names)
+        room += utf8::maxBytes(name.length()) + 2;
+
+    vector<char> out;
+    out.reserve(room);
+
+    double least = 0;
+    for (int run = 0; run < 3; ++run) {
+        out.clear();
+        auto start = chrono::steady_clock::now();
+        for (auto const& name : names) {
+            append(name, out);
+            out.push_back('\r');
+            out.push_back('\n');
+        }
+        double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (run == 0 || t < least)
+            least = t;
+    }
+    bytes = out.size();
+    return least;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? static_cast<size_t>(atol(argv[1])) : 200000;
+
+    const struct { const char* name; vector<wstring> words; } sets[] = {
+        { "ascii", { L"Love", L"Night", L"Song", L"Blue", L"Dancing", L"Remastered", L"Live", L"Heart", L"(Radio Edit)" } },
+        { "latin", { L"Caf\u00e9", L"Night", L"Se\u00f1orita", L"Blue", L"Tr\u00e4ume", L"Live", L"C\u0153ur", L"Song", L"Amor" } },
+        { "japanese", { L"\u591c", L"\u98a8\u306e\u6b4c", L"\u611b", L"\u6771\u4eac", L"\u82b1\u706b", L"\u6d77", L"\u30e9\u30a4\u30d6" } },
+    };
+
+    printf("%10s %12s %14s %14s", "set", "MB out", "utf8::append", "plain");
+#ifdef _WIN32
+    printf(" %14s", "WideChar...");
+#endif
+    printf("\n");
+
+    for (auto const& set : sets) {
+        auto names = makeNames(count, set.words);
+
+        size_t bytes = 0;
+        auto ours = best(names, [](wstring_view s, vector<char>& out) { utf8::append(s, out); }, bytes);
+        size_t plainBytes = 0;
+        auto plain = best(names, appendPlain, plainBytes);
+        if (plainBytes != bytes) {
+            fprintf(stderr, "%s: the encoders disagree\n", set.name);
+            return 1;
+        }
+
+        // ns per filename
+        auto ns = [&](double seconds) { return seconds * 1e9 / names.size(); };
+
+        printf("%10s %12.1f %11.1f ns %11.1f ns", set.name, bytes / 1e6, ns(ours), ns(plain));
+#ifdef _WIN32
+        size_t winBytes = 0;
+        auto win = best(names, appendWin32, winBytes);
+        printf(" %11.1f ns", ns(win));
+#endif
+        printf("\n");
+    }
+
+    printf("per filename, the best of three runs\n");
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <string>
+#include <string_view>
+#include <cwchar>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
+
+#include "flatmap.h"
+#include "arena.h"
+
+namespace syncplaylists {
+    namespace util {
+
+        using namespace std;
+
+        // in characters.  Most strings are paths, so a block holds hundreds.
+        static const size_t block_size = 64 * 1024;
+
+        static wstring_view place(wchar_t* p, wstring_view s)
+        {
+            ::wmemcpy(p, s.data(), s.length());
+            p[s.length()] = L'\0';
+            return wstring_view(p, s.length());
+        }
+
+        wstring_view StringArena::copy(wstring_view s)
+        {
+            auto need = s.length() + 1;
+
+            if (need > left) {
+                // a string that would waste most of a block gets one of its own
+                if (need > block_size / 4) {
+                    blocks.emplace_back(new wchar_t[need]);
+                    allocated += need * sizeof(wchar_t);
+                    return place(blocks.back().get(), s);
+                }
+
+                blocks.emplace_back(new wchar_t[block_size]);
+                allocated += block_size * sizeof(wchar_t);
+                cur = blocks.back().get();
+                left = block_size;
+            }
+
+            auto copied = place(cur, s);
+            cur += need;
+            left -= need;
+
+            return copied;
+        }
+
+        wstring_view StringArena::intern(wstring_view s)
+        {
+            auto found = interned.find(s);
+            if (found != interned.end())
+                return *found;
+
+            auto copied = copy(s);
+            interned.insert(copied);
+            return copied;
+        }
+
+    } // namespace util
+} // namespace syncplaylists
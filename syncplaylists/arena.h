@@ -0,0 +1,67 @@
+#pragma once
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+namespace syncplaylists {
+    namespace util {
+
+        // Strings that live as long as the arena, carved out of large blocks
+        // instead of being allocated one at a time.  Each copy is
+        // NUL-terminated, so its data() can be passed to the API.  Not
+        // thread safe, but the copies can be read from any thread.
+        class StringArena {
+        public:
+            StringArena() : cur(nullptr), left(0), allocated(0) {}
+
+            // copies s into the arena
+            std::wstring_view copy(std::wstring_view s);
+
+            // the copy an earlier intern made of a string equal to s, or a
+            // new one.  Filenames like "01 Intro.mp3" and folders like
+            // "Greatest Hits" come up again and again in a library.
+            std::wstring_view intern(std::wstring_view s);
+
+            // bytes taken by the blocks
+            size_t bytes() const { return allocated; }
+
+        private:
+            std::vector<std::unique_ptr<wchar_t[]> > blocks;
+            wchar_t* cur;
+            size_t left;
+            size_t allocated;
+            FlatSet<std::wstring_view, std::hash<std::wstring_view>, std::equal_to<> > interned;
+
+            // disallow copying
+            StringArena(StringArena const&) = delete;
+            void operator=(StringArena const&) = delete;
+        };
+
+    } // namespace util
+} // namespace syncplaylists
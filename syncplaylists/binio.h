@@ -0,0 +1,105 @@
+#pragma once
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+namespace syncplaylists {
+    namespace binio {
+
+        // builds the contents of one of our binary files (the library snapshot
+        // etc.) in memory.  Everything is stored in the machine's byte order,
+        // these files never leave the machine that wrote them.
+        class BinWriter {
+        public:
+            void putU32(unsigned int v) { put(&v, sizeof(v)); }
+            void putI32(long v)
+            {
+                auto i = static_cast<int>(v);
+                put(&i, sizeof(i));
+            }
+            void putU64(unsigned long long v) { put(&v, sizeof(v)); }
+            void putF64(double v) { put(&v, sizeof(v)); }
+            void putStr(std::wstring_view s)
+            {
+                putU32(static_cast<unsigned int>(s.length()));
+                put(s.data(), s.length() * sizeof(wchar_t));
+            }
+            void put(const void* p, size_t n)
+            {
+                auto b = static_cast<const char*>(p);
+                data.insert(data.end(), b, b + n);
+            }
+            // overwrite something already written, e.g. a count that wasn't known yet
+            void patchU32(size_t offset, unsigned int v) { ::memcpy(&data[offset], &v, sizeof(v)); }
+            size_t size() const { return data.size(); }
+            const std::vector<char>& bytes() const { return data; }
+        private:
+            std::vector<char> data;
+        };
+
+        // reads what a BinWriter wrote.  Every get returns false instead of
+        // reading past the end, so a truncated file is just an invalid one.
+        class BinReader {
+        public:
+            BinReader(const char* p, size_t n) : cur(p), end(p + n) {}
+            bool getU32(unsigned int& v) { return get(&v, sizeof(v)); }
+            bool getI32(long& v)
+            {
+                int i;
+                if (!get(&i, sizeof(i)))
+                    return false;
+                v = i;
+                return true;
+            }
+            bool getU64(unsigned long long& v) { return get(&v, sizeof(v)); }
+            bool getF64(double& v) { return get(&v, sizeof(v)); }
+            bool getStr(std::wstring& s)
+            {
+                unsigned int len;
+                if (!getU32(len) || len > static_cast<size_t>(end - cur) / sizeof(wchar_t))
+                    return false;
+                s.resize(len);
+                return len == 0 || get(&s[0], len * sizeof(wchar_t));
+            }
+            bool get(void* p, size_t n)
+            {
+                if (static_cast<size_t>(end - cur) < n)
+                    return false;
+                ::memcpy(p, cur, n);
+                cur += n;
+                return true;
+            }
+            bool atEnd() const { return cur == end; }
+        private:
+            const char* cur;
+            const char* end;
+        };
+
+    } // namespace binio
+} // namespace syncplaylists
@@ -53,6 +53,7 @@ namespace syncplaylists {
         struct ComInterfaceWrapper {
             T* iface;
             ComInterfaceWrapper() : iface(nullptr) {}
+            ComInterfaceWrapper(ComInterfaceWrapper&& other) noexcept : iface(other.iface) { other.iface = nullptr; }
             ~ComInterfaceWrapper()
             {
                 if (iface)
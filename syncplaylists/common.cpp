@@ -0,0 +1,83 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <windows.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include "common.h"
+#include "util.h"
+
+namespace syncplaylists {
+    namespace common {
+
+        using namespace std;
+
+        void getLocation(const Track& track, wstring& buf)
+        {
+            buf.clear();
+            paths::PathTable::append(track.dir, buf);
+            buf += track.filename;
+        }
+
+        Track& Library::addTrack(long databaseId, wstring_view location)
+        {
+            return add(databaseId, folders.dirOf(location), strings.intern(util::getFilename(location)));
+        }
+
+        Track& Library::addTrackByName(wstring_view filename)
+        {
+            return add(0, nullptr, strings.intern(filename));
+        }
+
+        Track& Library::add(long databaseId, const paths::Dir* dir, wstring_view filename)
+        {
+            Track track;
+            track.id = static_cast<TrackId>(tracks.size());
+            track.databaseId = databaseId;
+            track.dir = dir;
+            track.filename = filename;
+            track.size = 0;
+            track.lastWrite = 0;
+
+            tracks.push_back(track);
+            files.emplace(filename, track.id);
+
+            return tracks.back();
+        }
+
+    } // namespace common
+} // namespace syncplaylists
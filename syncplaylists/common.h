@@ -29,18 +29,107 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#include "names.h"
+#include "flatmap.h"
+#include "arena.h"
+#include "paths.h"
+
 namespace syncplaylists {
 	namespace common {		
 
-		struct Song {
-			std::wstring name;
-			std::wstring filename;
-			long order;
-		};		
+		// how copyFiles copies a file
+		enum class CopyBackend {
+			CopyFileApi,	// ::CopyFile
+			CopyFile2,	// ::CopyFile2, unbuffered
+			Blocks		// our own overlapped block copy
+		};
+
+		// the order files are copied in
+		enum class CopyOrder {
+			None,		// whatever order the map gives
+			Largest,	// largest first, while there is still contiguous free space
+			Path,		// by source path, so a spinning source disk reads sequentially
+			Playlist	// the first playlist on the command line is complete soonest
+		};
+
+		// command-line options
+		struct Options {
+			bool stats = false;	// report how long each phase takes
+			bool trustFs = false;	// stat source files instead of using what iTunes reports
+			std::wstring xmlPath;	// read the library from this XML export instead of from iTunes
+			unsigned threads = 0;	// threads for CPU bound work, 0 means one per core
+			bool refresh = false;	// walk every playlist instead of reusing the snapshot
+			bool offline = false;	// use the snapshot without connecting to iTunes
+			bool pipeline = false;	// copy while the playlists are still being read
+			unsigned copies = 4;	// files copied at the same time
+			CopyBackend copyBackend = CopyBackend::Blocks;
+			size_t blockSize = 4 * 1024 * 1024;	// for CopyBackend::Blocks
+			bool unbuffered = false;	// bypass the system cache when copying
+			bool verifyExtents = false;	// report fragmentation of the synced files
+			CopyOrder copyOrder = CopyOrder::Path;
+			bool verify = false;	// check the device against its manifest instead of syncing
+			bool contentCompare = false;	// also copy files whose source content changed but not its size
+			bool rescan = false;	// scan the device even if the index in its manifest is up to date
+		};
+
+		// the index of a track in Library::tracks
+		typedef std::uint32_t TrackId;
+
+		// a file track, with the size and last write time iTunes reports for
+		// its source file.  The strings are in the library's arena.
+		struct Track {
+			TrackId id;
+			long databaseId;	// TrackDatabaseID, 0 if not known
+			const paths::Dir* dir;	// the source folder, null if the track only has to be listed
+			std::wstring_view filename;	// of the source file, and of the copy
+			unsigned long long size;
+			unsigned long long lastWrite;	// FILETIME as 100ns ticks (UTC)
+		};
+
+		// builds the full path of the track's source file in buf, which can be
+		// reused from one track to the next
+		void getLocation(const Track& track, std::wstring& buf);
+
+		// called once for each track as it becomes known, before the
+		// playlists are complete.  Reading stops if it throws.
+		typedef std::function<void(const Track&)> TrackCallback;
+
+		// the playlists named on the command line
+		typedef util::FlatSet<std::wstring, std::hash<std::wstring_view>, std::equal_to<> > PlaylistNames_t;
+
+		//                              playlist        tracks in play order
+		typedef util::FlatMap<std::wstring, std::vector<TrackId>, std::hash<std::wstring_view>, std::equal_to<> > ItunesPlaylists_t;
+
+		//                              filename        track
+		typedef util::FlatMap<std::wstring_view, TrackId, names::NameHash, names::NameEqual> ItunesFiles_t;
+
+		// The selected playlists and their tracks.  A track that's in several
+		// playlists is stored once, and its strings are carved out of one
+		// arena rather than allocated one by one.
+		struct Library {
+			Library() : folders(strings) {}
+
+			// Adds a track with no size or time.  The location is split into
+			// its folder, which is shared with the other tracks in it, and
+			// the filename.  Tracks are never moved, so the reference stays
+			// good as more are added.
+			Track& addTrack(long databaseId, std::wstring_view location);
+
+			// adds a track that's only known by its filename on the device
+			Track& addTrackByName(std::wstring_view filename);
+
+			util::StringArena strings;
+			paths::PathTable folders;	// of the tracks' source files
+			std::deque<Track> tracks;	// by TrackId
+			ItunesFiles_t files;	// the first track with each filename
+			ItunesPlaylists_t playlists;
+
+		private:
+			Track& add(long databaseId, const paths::Dir* dir, std::wstring_view filename);
 
-		//                              playlist     names/filenames  
-		typedef std::unordered_map<std::wstring, std::vector<Song> > ItunesPlaylists_t;
-		//                            filename      fullpath
-		typedef std::unordered_map<std::wstring, std::wstring> ItunesFiles_t;
+			// disallow copying
+			Library(Library const&) = delete;
+			void operator=(Library const&) = delete;
+		};
 	} // namespace syncplaylists
 } // namespace common
@@ -0,0 +1,546 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <string_view>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+
+#include "common.h"
+#include "util.h"
+#include "workqueue.h"
+#include "xxhash.h"
+#include "manifest.h"
+#include "disk.h"
+#include "copier.h"
+
+namespace syncplaylists {
+    namespace copier {
+
+        using namespace std;
+        using namespace common;
+        using namespace util;
+
+        // closes the handle when it goes out of scope
+        struct HandleCloser {
+            HANDLE h;
+            explicit HandleCloser(HANDLE h) : h(h) {}
+            ~HandleCloser()
+            {
+                if (h != INVALID_HANDLE_VALUE && h != nullptr)
+                    ::CloseHandle(h);
+            }
+            // disallow copying
+            HandleCloser(HandleCloser const&) = delete;
+            void operator=(HandleCloser const&) = delete;
+        };
+
+        // Two page-aligned buffers for the block backend.  Each worker
+        // allocates them once and reuses them for every file it copies.
+        // Page alignment satisfies the sector alignment unbuffered I/O needs.
+        class BlockBuffers {
+        public:
+            explicit BlockBuffers(size_t size) : size(size)
+            {
+                for (int i = 0; i < 2; ++i) {
+                    buf[i] = static_cast<char*>(::VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+                }
+                throwIfFalse(buf[0] && buf[1], L"unable to allocate copy buffers");
+            }
+            ~BlockBuffers()
+            {
+                for (int i = 0; i < 2; ++i) {
+                    if (buf[i])
+                        ::VirtualFree(buf[i], 0, MEM_RELEASE);
+                }
+            }
+
+            char* buf[2];
+            size_t size;
+
+            // disallow copying
+            BlockBuffers(BlockBuffers const&) = delete;
+            void operator=(BlockBuffers const&) = delete;
+        };
+
+        // unbuffered writes must be a whole number of sectors.  A page is a
+        // multiple of any sector size we'll see.
+        static const DWORD unbuffered_align = 4096;
+
+        // waits for an overlapped read or write.  A read at the end of the
+        // file completes with 0 bytes.
+        static DWORD waitIo(HANDLE h, OVERLAPPED& ov, const wstring& path)
+        {
+            DWORD n = 0;
+            if (!::GetOverlappedResult(h, &ov, &n, TRUE)) {
+                auto err = ::GetLastError();
+                if (err != ERROR_HANDLE_EOF)
+                    fail(L"I/O error on " + path, HRESULT_FROM_WIN32(err));
+                n = 0;
+            }
+            return n;
+        }
+
+        static void setOffset(OVERLAPPED& ov, unsigned long long offset)
+        {
+            ov.Offset = static_cast<DWORD>(offset);
+            ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        }
+
+        // Reads and writes in large blocks with the two overlapped, so the read
+        // of the next block runs while the current one is being written.
+        // Each block is hashed while it's being written, so the manifest
+        // entry costs no second read.
+        static manifest::Entry copyBlocks(const wstring& src, const wstring& dst, const Options& opts, BlockBuffers& bufs)
+        {
+            DWORD extraFlags = opts.unbuffered ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_SEQUENTIAL_SCAN;
+
+            HandleCloser in(::CreateFile(src.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_FLAG_OVERLAPPED | extraFlags, nullptr));
+            throwLastErrorIfFalse(in.h != INVALID_HANDLE_VALUE, [&] { return L"unable to open " + src; });
+
+            FILETIME lastWrite;
+            throwLastErrorIfFalse(::GetFileTime(in.h, nullptr, nullptr, &lastWrite) != FALSE, [&] { return L"unable to get the time of " + src; });
+
+            extraFlags = opts.unbuffered ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : 0;
+
+            HandleCloser out(::CreateFile(dst.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                FILE_FLAG_OVERLAPPED | extraFlags, nullptr));
+            throwLastErrorIfFalse(out.h != INVALID_HANDLE_VALUE, [&] { return L"unable to create " + dst; });
+
+            // Reserve all the clusters before writing any, so the filesystem can
+            // give the file one contiguous run instead of growing it a block at
+            // a time next to the other files being copied.  Only the allocation
+            // is set, not the end of file, so FAT doesn't zero-fill it first.
+            // If it fails the copy still works, just without the hint.
+            LARGE_INTEGER srcSize;
+            if (::GetFileSizeEx(in.h, &srcSize) && srcSize.QuadPart > 0) {
+                FILE_ALLOCATION_INFO alloc;
+                alloc.AllocationSize = srcSize;
+                ::SetFileInformationByHandle(out.h, FileAllocationInfo, &alloc, sizeof(alloc));
+            }
+
+            HandleCloser readDone(::CreateEvent(nullptr, TRUE, FALSE, nullptr));
+            HandleCloser writeDone(::CreateEvent(nullptr, TRUE, FALSE, nullptr));
+            throwLastErrorIfFalse(readDone.h && writeDone.h, L"unable to create events");
+
+            OVERLAPPED rd, wr;
+            ::memset(&rd, 0, sizeof(rd));
+            ::memset(&wr, 0, sizeof(wr));
+            rd.hEvent = readDone.h;
+            wr.hEvent = writeDone.h;
+
+            auto blockSize = static_cast<DWORD>(bufs.size);
+
+            // false if the read hit the end of the file straight away
+            auto startRead = [&](int i, unsigned long long offset) -> bool {
+                setOffset(rd, offset);
+                if (!::ReadFile(in.h, bufs.buf[i], blockSize, nullptr, &rd)) {
+                    auto err = ::GetLastError();
+                    if (err == ERROR_HANDLE_EOF)
+                        return false;
+                    if (err != ERROR_IO_PENDING)
+                        fail(L"unable to read " + src, HRESULT_FROM_WIN32(err));
+                }
+                return true;
+            };
+
+            hash::XXH64 hasher;
+
+            bool reading = startRead(0, 0);
+            bool writing = false;
+            unsigned long long offset = 0;
+            int cur = 0;
+
+            try {
+                while (reading) {
+                    auto n = waitIo(in.h, rd, src);
+                    if (n == 0)
+                        break;
+
+                    // the previous write used the other buffer, which the next read is about to fill
+                    if (writing) {
+                        waitIo(out.h, wr, dst);
+                        writing = false;
+                    }
+
+                    // a short read means this is the last block
+                    reading = n == blockSize && startRead(cur ^ 1, offset + n);
+
+                    auto len = n;
+                    if (opts.unbuffered) {
+                        len = (n + unbuffered_align - 1) / unbuffered_align * unbuffered_align;
+                        ::memset(bufs.buf[cur] + n, 0, len - n);
+                    }
+
+                    setOffset(wr, offset);
+                    if (!::WriteFile(out.h, bufs.buf[cur], len, nullptr, &wr)) {
+                        auto err = ::GetLastError();
+                        if (err != ERROR_IO_PENDING)
+                            fail(L"unable to write " + dst, HRESULT_FROM_WIN32(err));
+                    }
+                    writing = true;
+
+                    hasher.update(bufs.buf[cur], n);
+
+                    offset += n;
+                    cur ^= 1;
+                }
+            } catch (...) {
+                // the kernel still owns rd, wr and the buffers until the I/O is done
+                DWORD n;
+                if (reading) {
+                    ::CancelIoEx(in.h, &rd);
+                    ::GetOverlappedResult(in.h, &rd, &n, TRUE);
+                }
+                if (writing) {
+                    ::CancelIoEx(out.h, &wr);
+                    ::GetOverlappedResult(out.h, &wr, &n, TRUE);
+                }
+                throw;
+            }
+
+            if (writing)
+                waitIo(out.h, wr, dst);
+
+            // the last unbuffered write was padded to a whole sector
+            if (opts.unbuffered) {
+                FILE_END_OF_FILE_INFO eof;
+                eof.EndOfFile.QuadPart = static_cast<LONGLONG>(offset);
+                throwLastErrorIfFalse(::SetFileInformationByHandle(out.h, FileEndOfFileInfo, &eof, sizeof(eof)) != FALSE,
+                    [&] { return L"unable to set the size of " + dst; });
+            }
+
+            // like CopyFile, keep the source's modification time
+            throwLastErrorIfFalse(::SetFileTime(out.h, nullptr, nullptr, &lastWrite) != FALSE, [&] { return L"unable to set the time of " + dst; });
+
+            // the caller renames the file into place, and it mustn't get there before its data
+            if (!opts.unbuffered)
+                throwLastErrorIfFalse(::FlushFileBuffers(out.h) != FALSE, [&] { return L"unable to flush " + dst; });
+
+            manifest::Entry entry;
+            entry.size = offset;
+            entry.lastWrite = (static_cast<unsigned long long>(lastWrite.dwHighDateTime) << 32) | lastWrite.dwLowDateTime;
+            entry.hash = hasher.digest();
+            entry.hashed = true;
+            entry.trackId = 0;
+            return entry;
+        }
+
+        // CopyFile2 calls this after each chunk.  If another copy has
+        // failed there's no point finishing this one.
+        static COPYFILE2_MESSAGE_ACTION CALLBACK copyProgress(const COPYFILE2_MESSAGE* msg, PVOID context)
+        {
+            auto failed = static_cast<const atomic<bool>*>(context);
+            if (msg->Type == COPYFILE2_CALLBACK_CHUNK_FINISHED && *failed)
+                return COPYFILE2_PROGRESS_CANCEL;
+            return COPYFILE2_PROGRESS_CONTINUE;
+        }
+
+        // The data is moved by the system with no buffers in our process and,
+        // with COPY_FILE_NO_BUFFERING, without going through the file cache
+        static void copyFile2(const wstring& src, const wstring& dst, const atomic<bool>& failed)
+        {
+            COPYFILE2_EXTENDED_PARAMETERS params;
+            ::memset(&params, 0, sizeof(params));
+            params.dwSize = sizeof(params);
+            params.dwCopyFlags = COPY_FILE_NO_BUFFERING;
+            params.pProgressRoutine = copyProgress;
+            params.pvCallbackContext = const_cast<atomic<bool>*>(&failed);
+
+            auto hRes = ::CopyFile2(src.c_str(), dst.c_str(), &params);
+
+            if (FAILED(hRes))
+                fail(L"failed to copy " + dst, hRes);
+        }
+
+        // makes sure what CopyFile wrote is on the device before it's renamed
+        static void flushFile(const wstring& path)
+        {
+            HandleCloser h(::CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr));
+            throwLastErrorIfFalse(h.h != INVALID_HANDLE_VALUE && ::FlushFileBuffers(h.h), [&] { return L"unable to flush " + path; });
+        }
+
+        // Copies to a temporary name and renames it when it's complete, so a
+        // file with the real name is never partial even if the device is
+        // pulled.  Returns the manifest entry for the copy.  src is reused
+        // for the source path from one file to the next.
+        static manifest::Entry copyFile(const wstring& usbroot, const Track& track, const Options& opts,
+            wstring& src, unique_ptr<BlockBuffers>& bufs, const atomic<bool>& failed)
+        {
+            getLocation(track, src);
+            wstring dst = usbroot;
+            dst += track.filename;
+            wstring tmp = dst + L"." + disk::partial_ext;
+
+            // the other backends never show us the data, so there's no hash
+            manifest::Entry entry;
+            entry.size = track.size;
+            entry.lastWrite = 0;
+            entry.hash = 0;
+            entry.hashed = false;
+
+            try {
+                if (opts.copyBackend == CopyBackend::Blocks) {
+                    if (!bufs)
+                        bufs.reset(new BlockBuffers(opts.blockSize));
+                    entry = copyBlocks(src, tmp, opts, *bufs);
+                } else if (opts.copyBackend == CopyBackend::CopyFile2) {
+                    // unbuffered, so there's nothing to flush
+                    copyFile2(src, tmp, failed);
+                } else {
+                    throwLastErrorIfFalse(::CopyFile(src.c_str(), tmp.c_str(), FALSE) != FALSE, [&] { return L"failed to copy " + dst; });
+                    flushFile(tmp);
+                }
+
+                // the copy keeps the source's time; the blocks backend already knows it
+                if (opts.copyBackend != CopyBackend::Blocks) {
+                    WIN32_FILE_ATTRIBUTE_DATA attrs;
+                    throwLastErrorIfFalse(::GetFileAttributesEx(tmp.c_str(), GetFileExInfoStandard, &attrs) != FALSE, [&] { return L"unable to get the size of " + tmp; });
+                    entry.size = (static_cast<unsigned long long>(attrs.nFileSizeHigh) << 32) | attrs.nFileSizeLow;
+                    entry.lastWrite = (static_cast<unsigned long long>(attrs.ftLastWriteTime.dwHighDateTime) << 32) | attrs.ftLastWriteTime.dwLowDateTime;
+                }
+                entry.trackId = track.databaseId;
+
+                throwLastErrorIfFalse(::MoveFileEx(tmp.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE,
+                    [&] { return L"unable to rename " + tmp + L" to " + dst; });
+            } catch (...) {
+                ::DeleteFile(tmp.c_str());
+                throw;
+            }
+
+            printOut(L"copied " + dst);
+
+            return entry;
+        }
+
+        void orderCopies(const Options& opts,
+            const vector<wstring>& playlistOrder,
+            const Library& library,
+            vector<TrackId>& tocopy)
+        {
+            if (opts.copyOrder == CopyOrder::None)
+                return;
+
+            auto track = [&](TrackId id) -> const Track& {
+                return library.tracks[id];
+            };
+
+            switch (opts.copyOrder) {
+            case CopyOrder::Largest:
+                stable_sort(tocopy.begin(), tocopy.end(), [&](TrackId a, TrackId b) {
+                    return track(a).size > track(b).size;
+                });
+                break;
+
+            case CopyOrder::Path: {
+                // case-insensitive like the filesystem, but without locale rules
+                auto compare = [](wstring_view a, wstring_view b) {
+                    return ::CompareStringOrdinal(a.data(), static_cast<int>(a.length()),
+                        b.data(), static_cast<int>(b.length()), TRUE);
+                };
+
+                // Folder by folder, then by name within each, so an album is
+                // read in one pass.  Only the folders' paths are built, once
+                // each, and sorted to rank them.
+                vector<pair<wstring, const paths::Dir*> > folders;
+                unordered_map<const paths::Dir*, size_t> folderRank;
+                for (auto id : tocopy) {
+                    auto dir = track(id).dir;
+                    if (folderRank.emplace(dir, 0).second) {
+                        folders.emplace_back(wstring(), dir);
+                        paths::PathTable::append(dir, folders.back().first);
+                    }
+                }
+                sort(folders.begin(), folders.end(), [&](const pair<wstring, const paths::Dir*>& a, const pair<wstring, const paths::Dir*>& b) {
+                    return compare(a.first, b.first) == CSTR_LESS_THAN;
+                });
+                for (size_t i = 0; i < folders.size(); ++i) {
+                    folderRank[folders[i].second] = i;
+                }
+
+                vector<size_t> rank(library.tracks.size());
+                for (auto id : tocopy) {
+                    rank[id] = folderRank[track(id).dir];
+                }
+
+                stable_sort(tocopy.begin(), tocopy.end(), [&](TrackId a, TrackId b) {
+                    if (rank[a] != rank[b])
+                        return rank[a] < rank[b];
+                    return compare(track(a).filename, track(b).filename) == CSTR_LESS_THAN;
+                });
+                break;
+            }
+
+            case CopyOrder::Playlist: {
+                // each file ranks by its first appearance, playlist by playlist
+                // in play order.  tocopy has the track each filename maps to,
+                // which is the one ranked.
+                const size_t unranked = ~static_cast<size_t>(0);
+                vector<size_t> rank(library.tracks.size(), unranked);
+                size_t next = 0;
+                for (auto const& plname : playlistOrder) {
+                    auto pl = library.playlists.find(plname);
+                    if (pl == library.playlists.end())
+                        continue;
+                    for (auto id : pl->second) {
+                        auto copied = library.files.find(track(id).filename)->second;
+                        if (rank[copied] == unranked)
+                            rank[copied] = next++;
+                    }
+                }
+                stable_sort(tocopy.begin(), tocopy.end(), [&](TrackId a, TrackId b) {
+                    return rank[a] < rank[b];
+                });
+                break;
+            }
+
+            default:
+                break;
+            }
+        }
+
+        void copyFiles(const wstring& usbroot,
+            const Library& library,
+            const vector<TrackId>& tocopy,
+            const Options& opts,
+            manifest::Entries_t& entries,
+            const function<void(size_t)>& onCopied)
+        {
+            CopyEngine engine(usbroot, opts, entries);
+
+            vector<size_t> indexes;
+            if (onCopied) {
+                indexes.resize(library.tracks.size());
+                for (size_t i = 0; i < tocopy.size(); ++i) {
+                    indexes[tocopy[i]] = i;
+                }
+                // indexes isn't changed once the copies start, so the workers can share it
+                engine.onCopied([&](const Track& track) { onCopied(indexes[track.id]); });
+            }
+
+            for (auto id : tocopy) {
+                auto const& track = library.tracks[id];
+                throwIfFalse(track.dir != nullptr, [&] { return L"no source for " + wstring(track.filename); });
+
+                if (!engine.add(track))
+                    break;
+            }
+
+            engine.finish();
+        }
+
+        CopyEngine::CopyEngine(const wstring& usbroot, const Options& opts, manifest::Entries_t& entries)
+            : usbroot(usbroot), opts(opts), entries(entries), queue(opts.copies * 4 + 16), ncopied(0), failed(false), started(false), elapsed(0)
+        {
+            auto ncopies = opts.copies < 1 ? 1 : opts.copies;
+
+            for (unsigned i = 0; i < ncopies; ++i) {
+                workers.emplace_back(&CopyEngine::worker, this);
+            }
+        }
+
+        CopyEngine::~CopyEngine()
+        {
+            // only does anything if finish wasn't called, e.g. while unwinding
+            failed = true;
+            stop();
+        }
+
+        bool CopyEngine::add(const Track& track)
+        {
+            if (!started) {
+                started = true;
+                sw.reset();
+            }
+            return !failed && queue.push(&track);
+        }
+
+        void CopyEngine::finish()
+        {
+            stop();
+
+            if (started)
+                elapsed = sw.seconds();
+
+            if (firstError)
+                rethrow_exception(firstError);
+        }
+
+        void CopyEngine::stop()
+        {
+            queue.close();
+            for (auto& t : workers) {
+                t.join();
+            }
+            workers.clear();
+        }
+
+        void CopyEngine::worker()
+        {
+            // allocated on first use, then reused for each file
+            unique_ptr<BlockBuffers> bufs;
+            wstring src;
+
+            const Track* track;
+            while (!failed && queue.pop(track)) {
+                try {
+                    auto entry = copyFile(usbroot, *track, opts, src, bufs, failed);
+                    {
+                        lock_guard<mutex> lock(entriesMutex);
+                        entries[wstring(track->filename)] = entry;
+                    }
+                    if (copiedCallback)
+                        copiedCallback(*track);
+                    ++ncopied;
+                } catch (...) {
+                    lock_guard<mutex> lock(errorMutex);
+                    if (!firstError)
+                        firstError = current_exception();
+                    failed = true;
+                    // wake anyone blocked in add
+                    queue.close();
+                }
+            }
+        }
+
+    } // namespace copier
+} // namespace syncplaylists
@@ -0,0 +1,106 @@
+#pragma once
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "common.h"
+#include "workqueue.h"
+#include "manifest.h"
+
+namespace syncplaylists {
+    namespace copier {
+
+        // sorts tocopy by opts.copyOrder.  playlistOrder is the playlists in
+        // the order they were given on the command line.
+        void orderCopies(const common::Options& opts,
+            const std::vector<std::wstring>& playlistOrder,
+            const common::Library& library,
+            std::vector<common::TrackId>& tocopy);
+
+        // copies the tracks in tocopy, opts.copies at a time, with the
+        // backend chosen in opts, and records each copy in entries.
+        // onCopied is called with the index in tocopy of each file copied.
+        void copyFiles(const std::wstring& usbroot,
+            const common::Library& library,
+            const std::vector<common::TrackId>& tocopy,
+            const common::Options& opts,
+            manifest::Entries_t& entries,
+            const std::function<void(size_t)>& onCopied = nullptr);
+
+        // Copies tracks to the device on several threads.  Tracks are added
+        // as they become known, and add blocks while the queue is full.
+        // The first copy that fails stops the others, and finish rethrows it.
+        // Each file copied gets its manifest entry in entries.
+        class CopyEngine {
+        public:
+            CopyEngine(const std::wstring& usbroot, const common::Options& opts, manifest::Entries_t& entries);
+            ~CopyEngine();
+
+            // called on a worker thread after each file is copied.  Set it
+            // before adding anything.
+            void onCopied(const common::TrackCallback& cb) { copiedCallback = cb; }
+
+            // returns false if a copy has already failed.  The track is
+            // used by reference, so it must not move before finish.
+            bool add(const common::Track& track);
+
+            // waits for the queued copies, then rethrows the first error if any
+            void finish();
+
+            size_t copied() const { return ncopied; }
+
+            // seconds from the first add until finish
+            double seconds() const { return elapsed; }
+
+        private:
+            void worker();
+            void stop();
+
+            std::wstring usbroot;
+            const common::Options& opts;
+            manifest::Entries_t& entries;
+            std::mutex entriesMutex;
+            common::TrackCallback copiedCallback;
+            util::BoundedQueue<const common::Track*> queue;
+            std::vector<std::thread> workers;
+            std::atomic<size_t> ncopied;
+            std::atomic<bool> failed;
+            std::exception_ptr firstError;
+            std::mutex errorMutex;
+            util::Stopwatch sw;
+            bool started;
+            double elapsed;
+
+            // disallow copying
+            CopyEngine(CopyEngine const&) = delete;
+            void operator=(CopyEngine const&) = delete;
+        };
+
+    } // namespace copier
+} // namespace syncplaylists
@@ -29,15 +29,25 @@ THE SOFTWARE.
 */
 
 #include <windows.h>
+#include <winioctl.h>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <deque>
+#include <cstdint>
 #include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
 #include <memory>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
 
 #include "common.h"
 #include "util.h"
+#include "utf8.h"
 #include "disk.h"
 
 namespace syncplaylists {
@@ -48,83 +58,99 @@ namespace syncplaylists {
         using namespace common;
         using namespace util;              
 
-        static void asciiToLower(wstring& s)
+        const wchar_t* const partial_ext = L"syncpart";
+
+        static unsigned long long fileTimeToTicks(const FILETIME& ft)
         {
-            // deliberately ignore locale
-            auto len = s.length();
-            for (size_t i = 0; i < len; ++i) {
-                if (s[i] >= 'A' && s[i] <= 'Z')
-                    s[i] += 'a' - 'A';
-            }
+            return (static_cast<unsigned long long>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
         }
 
-        static bool isInterestingFile(const wstring& filename)
+        static bool isInterestingFile(wstring_view filename)
         {
-            const static unordered_set<wstring> deletable_exts = { L"m3u", L"mp3", L"m4a" };
-
+            // deliberately ignore locale
             auto fileExt = getExtension(filename);
 
-            if (fileExt.length() < 1)
-                return false;
-
-            asciiToLower(fileExt);
+            return equalsIgnoreCase(fileExt, L"m3u") || equalsIgnoreCase(fileExt, L"mp3") ||
+                equalsIgnoreCase(fileExt, L"m4a");
+        }
 
-            return deletable_exts.find(fileExt) != deletable_exts.end();
+        static bool isSyncplaylistsFile(wstring_view filename)
+        {
+            return equalsIgnoreCase(filename.substr(0, 14), L"syncplaylists.");
         }
 
-        static void writePlaylist(const wstring& usbroot,
-            const wstring& plname,
-            const vector<Song>& pl)
+        // our temporary files: songs being copied and files being saved
+        static bool isLeftover(wstring_view filename)
         {
-            
-            vector<const Song*> songs(pl.size());
+            auto ext = getExtension(filename);
+            if (equalsIgnoreCase(ext, partial_ext))
+                return true;
+            if (!equalsIgnoreCase(ext, L"tmp"))
+                return false;
 
-            for (size_t i = 0; i < pl.size(); ++i) {
-                songs[i] = &pl[i];
-            }
+            // the manifest and the playlists are saved through name.tmp
+            auto saved = filename.substr(0, filename.length() - ext.length() - 1);
+            return isSyncplaylistsFile(saved) || equalsIgnoreCase(getExtension(saved), L"m3u");
+        }
 
-            // we sort by playlist order         
-            auto less_for_songs = [](const Song* a, const Song* b) -> bool {
-                return a->order < b->order;                
-            };
+        // one line per song, in play order, as the file should be on the
+        // device.  data is reused from one playlist to the next.
+        static void renderPlaylist(const vector<TrackId>& pl, const Library& library, vector<char>& data)
+        {
+            // room for the worst case, so the conversion never reallocates
+            size_t size = 0;
+            for (auto id : pl) {
+                size += utf8::maxBytes(library.tracks[id].filename.length()) + 2;
+            }
 
-            sort(songs.begin(), songs.end(), less_for_songs);
+            data.clear();
+            data.reserve(size);
 
-            wstring plpath = usbroot + plname + L".m3u";
+            for (auto id : pl) {
+                utf8::append(library.tracks[id].filename, data);
+                data.push_back('\r');
+                data.push_back('\n');
+            }
+        }
 
-            auto open_file = [](const wstring& path) -> FILE* {
-                FILE* f;
-                if (::_wfopen_s(&f, path.c_str(), L"wb") == 0)
-                    return f;
-                else
-                    return static_cast<FILE*>(nullptr);
-            };
+        // true if the file already holds exactly data
+        static bool sameContents(const wstring& path, const vector<char>& data)
+        {
+            if (data.empty()) {
+                // an empty file can't be mapped
+                WIN32_FILE_ATTRIBUTE_DATA attrs;
+                return ::GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attrs) &&
+                    attrs.nFileSizeHigh == 0 && attrs.nFileSizeLow == 0;
+            }
 
-            auto close_file = [](FILE* fl) {if (fl) ::fclose(fl); };
+            MappedFile existing;
+            return existing.open(path) && existing.size() == data.size() &&
+                ::memcmp(existing.data(), &data[0], data.size()) == 0;
+        }
 
-            unique_ptr <FILE, decltype(close_file)>  fl(open_file(plpath), close_file);
+        // A playlist that hasn't changed is left alone, so the device isn't
+        // written and the player doesn't index it again
+        static void writePlaylist(const wstring& usbroot,
+            const wstring& plname,
+            const vector<TrackId>& pl,
+            const Library& library,
+            vector<char>& data)
+        {
+            wstring plpath = usbroot + plname + L".m3u";
 
-            throwIfFalse(fl.get() != nullptr, L"unable to open " + plpath + L" for writing");
+            renderPlaylist(pl, library, data);
 
-            string filename_utf8;
+            if (sameContents(plpath, data))
+                return;
 
-            for (auto song : songs) {               
-                filename_utf8.clear();
-                auto p = unicodeToUtf8(song->filename.c_str(), filename_utf8);
-                throwIfFalse(p, L"cannot convert filename " + song->filename + L" to utf8");
-                auto n = fwrite(p, 1, filename_utf8.length(), fl.get());
-                throwIfFalse(n == filename_utf8.length(), L"did not write correct number of bytes to " + plpath);
-                auto cw = fputc('\r', fl.get());
-                throwIfFalse(cw != EOF, L"did not write correct number of bytes to " + plpath);
-                cw = fputc('\n', fl.get());
-                throwIfFalse(cw != EOF, L"did not write correct number of bytes to " + plpath);
-            }
+            // in one WriteFile
+            writeFileAtomic(plpath, data);
 
             printOut(L"wrote " + plpath);
         }
 
         // public functions
-        void getFilesOnDisk(const wstring& usbroot, DiskFiles_t& ondisk)
+        void getFilesOnDisk(const wstring& usbroot, DiskFiles& ondisk)
         {
             WIN32_FIND_DATA fd;
 
@@ -132,7 +158,7 @@ namespace syncplaylists {
 
             auto hFind = ::FindFirstFile((usbroot + L"*").c_str(), &fd);
 
-            throwIfFalse(hFind != INVALID_HANDLE_VALUE, L"error finding files in " + usbroot);
+            throwLastErrorIfFalse(hFind != INVALID_HANDLE_VALUE, [&] { return L"error finding files in " + usbroot; });
 
             while (hFind != INVALID_HANDLE_VALUE) {
 
@@ -140,10 +166,21 @@ namespace syncplaylists {
                     if (::wcscmp(fd.cFileName, L".") != 0 && ::wcscmp(fd.cFileName, L"..") != 0) {
                         printOut(wstring(L"ignoring directory ") + fd.cFileName);
                     }
+                } else if (isLeftover(fd.cFileName)) {
+                    // a copy or a save that never finished
+                    wstring path = usbroot + fd.cFileName;
+                    if (::DeleteFile(path.c_str()))
+                        printOut(L"removed unfinished " + path);
+                } else if (isSyncplaylistsFile(fd.cFileName)) {
+                    // the manifest or the journal
                 } else if (!isInterestingFile(fd.cFileName)) {
                     printOut(wstring(L"ignoring file ") + fd.cFileName);
                 } else {
-                    ondisk.insert(fd.cFileName);
+                    DiskFile df;
+                    df.size = (static_cast<unsigned long long>(fd.nFileSizeHigh) << 32) | fd.nFileSizeLow;
+                    df.lastWrite = fileTimeToTicks(fd.ftLastWriteTime);
+                    if (!ondisk.add(fd.cFileName, df))
+                        ondisk.addDuplicate(fd.cFileName);
                 }
 
                 if (!::FindNextFile(hFind, &fd))
@@ -158,74 +195,308 @@ namespace syncplaylists {
                 ::FindClose(hFind);
             }
 
-            throwIfFalse(LastErr == ERROR_NO_MORE_FILES, L"FindNextFile on " + usbroot + L" returned error " + to_wstring(LastErr));
+            if (LastErr != ERROR_NO_MORE_FILES)
+                fail(L"FindNextFile failed on " + usbroot, HRESULT_FROM_WIN32(LastErr));
         }
 
-        void deleteFiles(const wstring& usbroot,
-            const ItunesFiles_t& itunesfiles,
-            const DiskFiles_t& ondisk)
+        // renames from to to, which are equal names, on the device and in ondisk
+        static void renameFile(const wstring& usbroot, wstring_view from, wstring_view to, DiskFiles& ondisk)
+        {
+            wstring fromPath = usbroot, toPath = usbroot;
+            fromPath += from;
+            toPath += to;
+            throwLastErrorIfFalse(::MoveFileEx(fromPath.c_str(), toPath.c_str(), MOVEFILE_WRITE_THROUGH) != FALSE,
+                [&] { return L"unable to rename " + fromPath + L" to " + toPath; });
+            printOut(L"renamed " + fromPath + L" to " + toPath);
+
+            // the key has to change too, and an equal key won't replace it
+            ondisk.rename(from, to);
+        }
+
+        void renameToMatch(const wstring& usbroot,
+            const Library& library,
+            DiskFiles& ondisk)
         {
+            // both names are views that outlive the renames
+            vector<pair<wstring_view, wstring_view> > renames;
             for (auto const& it : ondisk) {
-                wstring path = usbroot + it;
-                if (itunesfiles.find(it) == itunesfiles.end()) {
-                    auto delRes = ::DeleteFile(path.c_str());
-                    if (delRes) {
-                        printOut(L"deleted " + path);
+                auto found = library.files.find(it.first);
+                if (found != library.files.end() && found->first != it.first)
+                    renames.emplace_back(it.first, found->first);
+            }
+
+            for (auto const& r : renames) {
+                renameFile(usbroot, r.first, r.second, ondisk);
+            }
+        }
+
+        void renameToMatch(const wstring& usbroot,
+            wstring_view filename,
+            DiskFiles& ondisk)
+        {
+            auto found = ondisk.find(filename);
+            if (found != ondisk.end() && found->first != filename)
+                renameFile(usbroot, found->first, filename, ondisk);
+        }
+
+        void getFilesToDelete(const Library& library,
+            const DiskFiles& ondisk,
+            vector<wstring>& todelete)
+        {
+            // the selected playlists are rewritten only if they changed
+            util::FlatSet<wstring_view, names::NameHash, names::NameEqual> playlists;
+            for (auto const& it : library.playlists) {
+                playlists.insert(it.first);
+            }
+
+            auto isSelectedPlaylist = [&](wstring_view filename) {
+                auto ext = getExtension(filename);
+                return equalsIgnoreCase(ext, L"m3u") &&
+                    playlists.find(filename.substr(0, filename.length() - ext.length() - 1)) != playlists.end();
+            };
+
+            for (auto const& it : ondisk) {
+                if (library.files.find(it.first) == library.files.end() && !isSelectedPlaylist(it.first)) {
+                    todelete.emplace_back(it.first);
+                }
+            }
+
+            // only one of each set of equal names can be kept
+            for (auto filename : ondisk.duplicates()) {
+                todelete.emplace_back(filename);
+            }
+        }
+
+        void deleteFiles(const wstring& usbroot,
+            const vector<wstring>& todelete,
+            const function<void(size_t)>& onDeleted)
+        {
+            for (size_t i = 0; i < todelete.size(); ++i) {
+                wstring path = usbroot + todelete[i];
+                auto delRes = ::DeleteFile(path.c_str());
+                auto err = delRes ? ERROR_SUCCESS : ::GetLastError();
+                if (delRes) {
+                    printOut(L"deleted " + path);
+                }
+                // already gone is fine when resuming
+                if (!delRes && err != ERROR_FILE_NOT_FOUND)
+                    fail(L"failed to delete " + path, HRESULT_FROM_WIN32(err));
+                if (onDeleted)
+                    onDeleted(i);
+            }
+        }
+
+        void statSourceFiles(Library& library)
+        {
+            vector<Track*> tracks;
+            tracks.reserve(library.files.size());
+            for (auto const& it : library.files) {
+                tracks.push_back(&library.tracks[it.second]);
+            }
+
+            // the source is often a network or spinning disk, so keep several
+            // requests in flight rather than one per core
+            const size_t max_threads = 16;
+            auto nthreads = min(max_threads, tracks.size());
+
+            atomic<size_t> next(0);
+
+            auto worker = [&]() {
+                wstring location;
+                for (auto i = next++; i < tracks.size(); i = next++) {
+                    WIN32_FILE_ATTRIBUTE_DATA attrs;
+                    getLocation(*tracks[i], location);
+                    if (::GetFileAttributesEx(location.c_str(), GetFileExInfoStandard, &attrs)) {
+                        tracks[i]->size = (static_cast<unsigned long long>(attrs.nFileSizeHigh) << 32) | attrs.nFileSizeLow;
+                        tracks[i]->lastWrite = fileTimeToTicks(attrs.ftLastWriteTime);
                     }
-                    throwIfFalse(delRes, L"failed to delete " + path);
                 }
+            };
+
+            vector<thread> threads;
+            for (size_t i = 0; i < nthreads; ++i) {
+                threads.emplace_back(worker);
+            }
+            for (auto& t : threads) {
+                t.join();
             }
         }
 
-        void copyFiles(const wstring& usbroot,
-            const ItunesFiles_t& itunesfiles,
-            const DiskFiles_t& ondisk)
+        bool needsCopy(const Track& track, const DiskFiles& ondisk)
         {
-            for (auto const& it : itunesfiles) {
-                wstring dst = usbroot + it.first;
-                bool shouldCopy = false;
+            // Check if the file is missing in the destination
+            auto found = ondisk.find(track.filename);
+            if (found == ondisk.end()) {
+                return true;
+            }
 
-                // Check if the file is missing in the destination
-                auto found = ondisk.find(it.first);
-                if (found == ondisk.end()) {
-                    shouldCopy = true;
+            // File exists; compare its size from the scan with the source.
+            // Only ask the source filesystem if iTunes didn't tell us the size
+            auto srcSize = track.size;
+            if (srcSize == 0) {
+                WIN32_FILE_ATTRIBUTE_DATA srcAttrs;
+                wstring location;
+                getLocation(track, location);
+                if (!::GetFileAttributesEx(location.c_str(), GetFileExInfoStandard, &srcAttrs)) {
+                    return false;
                 }
-                else {
-                    // File exists; check file sizes
-                    LARGE_INTEGER srcSize, dstSize;
-                    HANDLE hSrc = CreateFile(it.second.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-                    HANDLE hDst = CreateFile(dst.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-
-                    if (hSrc != INVALID_HANDLE_VALUE && hDst != INVALID_HANDLE_VALUE) {
-                        if (GetFileSizeEx(hSrc, &srcSize) && GetFileSizeEx(hDst, &dstSize)) {
-                            if (srcSize.QuadPart != dstSize.QuadPart) {
-                                shouldCopy = true;
-                            }
-                        }
-                    }
+                srcSize = (static_cast<unsigned long long>(srcAttrs.nFileSizeHigh) << 32) | srcAttrs.nFileSizeLow;
+            }
 
-                    if (hSrc != INVALID_HANDLE_VALUE) CloseHandle(hSrc);
-                    if (hDst != INVALID_HANDLE_VALUE) CloseHandle(hDst);
+            return srcSize != found->second.size;
+        }
+
+        void getFilesToCopy(const Library& library,
+            const DiskFiles& ondisk,
+            vector<TrackId>& tocopy)
+        {
+            for (auto const& it : library.files) {
+                if (needsCopy(library.tracks[it.second], ondisk)) {
+                    tocopy.push_back(it.second);
                 }
+            }
+        }
 
-                // Copy the file if needed
-                if (shouldCopy) {
-                    auto cpRes = ::CopyFile(it.second.c_str(), dst.c_str(), FALSE);
-                    if (cpRes) {
-                        printOut(L"copied " + dst);
-                    }
-                    throwIfFalse(cpRes, L"failed to copy " + dst);
+        // the number of separate runs of clusters the file occupies, with
+        // runs that happen to be adjacent counted as one
+        static unsigned long long countExtents(const wstring& path)
+        {
+            auto h = ::CreateFile(path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+            throwLastErrorIfFalse(h != INVALID_HANDLE_VALUE, [&] { return L"unable to open " + path; });
+
+            STARTING_VCN_INPUT_BUFFER in;
+            in.StartingVcn.QuadPart = 0;
+
+            // room for a good number of extents per call
+            vector<char> outbuf(sizeof(RETRIEVAL_POINTERS_BUFFER) + 255 * 2 * sizeof(LARGE_INTEGER));
+            auto out = reinterpret_cast<RETRIEVAL_POINTERS_BUFFER*>(&outbuf[0]);
+
+            unsigned long long extents = 0;
+            LONGLONG nextLcn = -1;
+            DWORD err = ERROR_SUCCESS;
+
+            for (;;) {
+                DWORD n;
+                err = ERROR_SUCCESS;
+                if (!::DeviceIoControl(h, FSCTL_GET_RETRIEVAL_POINTERS, &in, sizeof(in), out, static_cast<DWORD>(outbuf.size()), &n, nullptr)) {
+                    err = ::GetLastError();
+                    // an empty file has no clusters at all
+                    if (err != ERROR_MORE_DATA)
+                        break;
+                }
+
+                auto vcn = out->StartingVcn.QuadPart;
+                for (DWORD i = 0; i < out->ExtentCount; ++i) {
+                    auto lcn = out->Extents[i].Lcn.QuadPart;
+                    auto len = out->Extents[i].NextVcn.QuadPart - vcn;
+                    if (lcn != nextLcn)
+                        ++extents;
+                    nextLcn = lcn + len;
+                    vcn = out->Extents[i].NextVcn.QuadPart;
                 }
+
+                if (err != ERROR_MORE_DATA)
+                    break;
+
+                in.StartingVcn.QuadPart = vcn;
             }
+
+            ::CloseHandle(h);
+
+            if (err != ERROR_SUCCESS && err != ERROR_HANDLE_EOF)
+                fail(L"unable to get the extents of " + path, HRESULT_FROM_WIN32(err));
+
+            return extents;
         }
 
-        void writePlaylists(const wstring& usbroot,
-            const ItunesPlaylists_t& initunes)
+        void reportExtents(const wstring& usbroot, const Library& library, CopyBackend backend)
         {
-            for (auto const& it : initunes) {
-                writePlaylist(usbroot, it.first, it.second);
+            unsigned long long nfiles = 0, total = 0, fragmented = 0, most = 0;
+            wstring_view mostName;
+            wstring path;
+
+            for (auto const& it : library.files) {
+                path = usbroot;
+                path += it.first;
+                // a song that couldn't be copied shouldn't hide the others
+                unsigned long long extents;
+                try {
+                    extents = countExtents(path);
+                } catch (const Error& e) {
+                    printErr(e.message());
+                    continue;
+                }
+                ++nfiles;
+                total += extents;
+                if (extents > 1)
+                    ++fragmented;
+                if (extents > most) {
+                    most = extents;
+                    mostName = it.first;
+                }
+            }
+
+            if (nfiles == 0)
+                return;
+
+            printOut(to_wstring(nfiles) + L" files on " + usbroot + L" are in " + to_wstring(total) + L" extents (" +
+                to_wstring(static_cast<double>(total) / nfiles) + L" per file), " + to_wstring(fragmented) + L" are fragmented");
+
+            if (most > 1)
+                printOut(L"the most fragmented is " + wstring(mostName) + L" with " + to_wstring(most) + L" extents");
+
+            // only the blocks backend preallocates, so the numbers say
+            // nothing about it unless it did the copying
+            if (backend != CopyBackend::Blocks) {
+                printOut(wstring(L"files copied this run used the ") +
+                    (backend == CopyBackend::CopyFile2 ? L"copyfile2" : L"copyfile") +
+                    L" backend, which doesn't reserve their space");
             }
         }
 
+        void writePlaylists(const wstring& usbroot, const Library& library)
+        {
+            vector<const ItunesPlaylists_t::value_type*> playlists;
+            for (auto const& it : library.playlists) {
+                playlists.push_back(&it);
+            }
+
+            // most of the time goes to rendering and comparing, not writing
+            size_t nthreads = thread::hardware_concurrency();
+            if (nthreads < 1)
+                nthreads = 1;
+            nthreads = min(nthreads, playlists.size());
+
+            atomic<size_t> next(0);
+            mutex errorMutex;
+            exception_ptr firstError;
+
+            auto worker = [&]() {
+                vector<char> data;
+                for (auto i = next++; i < playlists.size(); i = next++) {
+                    try {
+                        writePlaylist(usbroot, playlists[i]->first, playlists[i]->second, library, data);
+                    } catch (...) {
+                        lock_guard<mutex> lock(errorMutex);
+                        if (!firstError)
+                            firstError = current_exception();
+                        // no point starting the others
+                        next = playlists.size();
+                    }
+                }
+            };
+
+            vector<thread> threads;
+            for (size_t i = 0; i < nthreads; ++i) {
+                threads.emplace_back(worker);
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+
+            if (firstError)
+                rethrow_exception(firstError);
+        }
+
 	} // namespace disk
 } // namespace syncplaylists
@@ -31,21 +31,114 @@ THE SOFTWARE.
 
 namespace syncplaylists {
 	namespace disk {
-		void getFilesOnDisk(const std::wstring& usbroot, std::unordered_set<std::wstring>& ondisk);
+		// what the directory scan tells us about a file on the device
+		struct DiskFile {
+			unsigned long long size;
+			unsigned long long lastWrite;	// FILETIME as 100ns ticks
+		};
 
+		// bare filename -> metadata from the scan, matched as the device
+		// matches names.  The names are kept in an arena and the keys are
+		// views of them, so a track's filename is looked up as it is.
+		class DiskFiles {
+		public:
+			typedef util::FlatMap<std::wstring_view, DiskFile, names::NameHash, names::NameEqual> Map_t;
+
+			DiskFiles() {}
+
+			// does nothing, and returns false, if there's already a file
+			// with an equal name
+			bool add(std::wstring_view filename, const DiskFile& df)
+			{
+				if (files.find(filename) != files.end())
+					return false;
+				files.emplace(arena.copy(filename), df);
+				return true;
+			}
+
+			// The device keeps the NFC and NFD forms of a name as two files,
+			// but they're equal here, so only the first found is in the map.
+			// The others are listed to be deleted.
+			void addDuplicate(std::wstring_view filename) { dups.push_back(arena.copy(filename)); }
+			const std::vector<std::wstring_view>& duplicates() const { return dups; }
+			void clearDuplicates() { dups.clear(); }
+
+			// the file now has the name to
+			void rename(std::wstring_view from, std::wstring_view to)
+			{
+				auto found = files.find(from);
+				util::throwIfFalse(found != files.end(), L"renaming a file that isn't on the device");
+				auto df = found->second;
+				files.erase(from);
+				add(to, df);
+			}
+
+			Map_t::const_iterator find(std::wstring_view filename) const { return files.find(filename); }
+			Map_t::const_iterator begin() const { return files.begin(); }
+			Map_t::const_iterator end() const { return files.end(); }
+			size_t size() const { return files.size(); }
+
+		private:
+			util::StringArena arena;
+			Map_t files;
+			std::vector<std::wstring_view> dups;
+
+			// disallow copying
+			DiskFiles(DiskFiles const&) = delete;
+			void operator=(DiskFiles const&) = delete;
+		};
+
+		// Songs are copied to filename.syncpart and renamed when complete, so
+		// a file with this extension is from a copy that was interrupted
+		extern const wchar_t* const partial_ext;
+
+		// also removes files left by interrupted copies
+		void getFilesOnDisk(const std::wstring& usbroot, DiskFiles& ondisk);
+
+		// Renames files on the device whose names differ from their track's
+		// only in case or normalization, so the playlists name them exactly
+		void renameToMatch(const std::wstring& usbroot,
+			const common::Library& library,
+			DiskFiles& ondisk);
+
+		// the same for one filename, for the pipeline to call before it
+		// copies the track
+		void renameToMatch(const std::wstring& usbroot,
+			std::wstring_view filename,
+			DiskFiles& ondisk);
+
+		// the files on the device that aren't in any of the playlists, the
+		// playlist files that aren't selected, and the duplicates in ondisk.
+		// They're deleted before renameToMatch, which would collide with a
+		// duplicate.
+		void getFilesToDelete(const common::Library& library,
+			const DiskFiles& ondisk,
+			std::vector<std::wstring>& todelete);
+
+		// onDeleted is called with the index of each file once it's gone
 		void deleteFiles(const std::wstring& usbroot,
-			const common::ItunesFiles_t& itunesfiles,
-			const std::unordered_set<std::wstring>& ondisk);
+			const std::vector<std::wstring>& todelete,
+			const std::function<void(size_t)>& onDeleted = nullptr);
+
+		// replaces the sizes and times iTunes reported with the ones from the
+		// source filesystem, several files at a time
+		void statSourceFiles(common::Library& library);
 
-		void copyFiles(const std::wstring& usbroot,
-			const common::ItunesFiles_t& itunesfiles,
-			const std::unordered_set<std::wstring>& ondisk);
+		// true if the track is missing from the device or its size differs.
+		// Compares against the scan, so the device is not touched
+		bool needsCopy(const common::Track& track, const DiskFiles& ondisk);
 
+		void getFilesToCopy(const common::Library& library,
+			const DiskFiles& ondisk,
+			std::vector<common::TrackId>& tocopy);
 
-		void writePlaylists(const std::wstring& usbroot,
-			const std::unordered_map<std::wstring, std::vector<common::Song> >& initunes);
+		// reports how many extents the synced files occupy on the device, to
+		// show how fragmented they are, and says if backend, which copied
+		// the files this run, didn't reserve their space.  A file that can't
+		// be opened is reported and left out.
+		void reportExtents(const std::wstring& usbroot, const common::Library& library, common::CopyBackend backend);
 
-		// bare filenames
-		typedef std::unordered_set<std::wstring> DiskFiles_t;
+		// writes only the playlists whose contents changed
+		void writePlaylists(const std::wstring& usbroot, const common::Library& library);
 	} // namespace disk
 } // namespace syncplaylists
@@ -0,0 +1,344 @@
+#pragma once
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// The probes need SSE2, which every x64 CPU has.  The intrinsics are
+// included here rather than by each file that uses a FlatMap.
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace syncplaylists {
+    namespace util {
+
+        // Hash table that keeps its entries in one array instead of a node
+        // per entry.  Each slot has a control byte that is empty, deleted, or
+        // the low 7 bits of the entry's hash, and a probe checks 16 of them
+        // at once with SSE2, so Equal is only called for slots that are
+        // likely to match.  The full hash of each entry is kept as well, so
+        // growing the table doesn't hash anything again and a key is only
+        // compared when the whole hash matches.
+        //
+        // Lookups take anything Hash and Equal accept, so a table keyed by
+        // wstring can be searched with a wstring_view.  Unlike the
+        // unordered containers, inserting or erasing moves entries, so it
+        // invalidates iterators and references.  KeyOf gets the key from an
+        // entry, which must not be changed in place.
+        template <typename Value, typename KeyOf, typename Hash, typename Equal>
+        class FlatTable {
+            template <bool Const>
+            class Iter {
+                typedef typename std::conditional<Const, const FlatTable, FlatTable>::type Table;
+            public:
+                Iter() : table(nullptr), i(0) {}
+                Iter(Table* table, size_t i) : table(table), i(i) { skip(); }
+
+                operator Iter<true>() const { return Iter<true>(table, i); }
+
+                auto& operator*() const { return table->slots[i]; }
+                auto* operator->() const { return &table->slots[i]; }
+                Iter& operator++() { ++i; skip(); return *this; }
+                bool operator==(const Iter& other) const { return i == other.i; }
+                bool operator!=(const Iter& other) const { return i != other.i; }
+
+            private:
+                void skip()
+                {
+                    while (i < table->slots.size() && table->ctrl[i] < 0)
+                        ++i;
+                }
+
+                Table* table;
+                size_t i;
+            };
+
+        public:
+            typedef Value value_type;
+            typedef Iter<false> iterator;
+            typedef Iter<true> const_iterator;
+
+            FlatTable() : mask(0), count(0), growthLeft(0) {}
+
+            template <typename It>
+            FlatTable(It first, It last) : FlatTable()
+            {
+                for (; first != last; ++first)
+                    insert(*first);
+            }
+
+            iterator begin() { return iterator(this, 0); }
+            iterator end() { return iterator(this, slots.size()); }
+            const_iterator begin() const { return const_iterator(this, 0); }
+            const_iterator end() const { return const_iterator(this, slots.size()); }
+
+            size_t size() const { return count; }
+            bool empty() const { return count == 0; }
+
+            template <typename K>
+            iterator find(const K& key)
+            {
+                auto i = indexOf(key, Hash()(key));
+                return i == npos ? end() : iterator(this, i);
+            }
+
+            template <typename K>
+            const_iterator find(const K& key) const
+            {
+                auto i = indexOf(key, Hash()(key));
+                return i == npos ? end() : const_iterator(this, i);
+            }
+
+            // does nothing if there's already an entry with an equal key
+            std::pair<iterator, bool> insert(Value value)
+            {
+                auto const& key = KeyOf()(value);
+                auto h = Hash()(key);
+                auto i = indexOf(key, h);
+                if (i != npos)
+                    return std::make_pair(iterator(this, i), false);
+                i = place(h);
+                slots[i] = std::move(value);
+                return std::make_pair(iterator(this, i), true);
+            }
+
+            template <typename... Args>
+            std::pair<iterator, bool> emplace(Args&&... args)
+            {
+                return insert(Value(std::forward<Args>(args)...));
+            }
+
+            // the value for key, default constructed if it isn't there yet
+            template <typename K>
+            auto& operator[](const K& key)
+            {
+                auto h = Hash()(key);
+                auto i = indexOf(key, h);
+                if (i == npos) {
+                    i = place(h);
+                    slots[i].first = key;
+                }
+                return slots[i].second;
+            }
+
+            template <typename K>
+            size_t erase(const K& key)
+            {
+                auto i = indexOf(key, Hash()(key));
+                if (i == npos)
+                    return 0;
+                // a probe for another key may have passed this slot, so it
+                // can't go back to empty
+                setCtrl(i, deletedSlot);
+                slots[i] = Value();
+                --count;
+                return 1;
+            }
+
+            void clear()
+            {
+                std::fill(ctrl.begin(), ctrl.end(), emptySlot);
+                for (auto& slot : slots)
+                    slot = Value();
+                count = 0;
+                growthLeft = maxLoad(slots.size());
+            }
+
+            // makes room for n entries without growing again
+            void reserve(size_t n)
+            {
+                size_t capacity = group;
+                while (maxLoad(capacity) < n)
+                    capacity *= 2;
+                if (capacity > slots.size())
+                    rehash(capacity);
+            }
+
+            bool operator==(const FlatTable& other) const
+            {
+                if (count != other.count)
+                    return false;
+                for (auto const& value : *this) {
+                    auto found = other.find(KeyOf()(value));
+                    if (found == other.end() || !(*found == value))
+                        return false;
+                }
+                return true;
+            }
+
+            bool operator!=(const FlatTable& other) const { return !(*this == other); }
+
+        private:
+            static constexpr size_t npos = static_cast<size_t>(-1);
+            static constexpr size_t group = 16;
+            static constexpr signed char emptySlot = -128;
+            static constexpr signed char deletedSlot = -2;
+
+            // 7/8 full before growing
+            static size_t maxLoad(size_t capacity) { return capacity - capacity / 8; }
+
+            static signed char tag(size_t h) { return static_cast<signed char>(h & 0x7f); }
+
+            // bits isn't zero
+            static unsigned lowestBit(unsigned bits)
+            {
+#ifdef _MSC_VER
+                unsigned long i;
+                _BitScanForward(&i, bits);
+                return static_cast<unsigned>(i);
+#else
+                return static_cast<unsigned>(__builtin_ctz(bits));
+#endif
+            }
+
+            // a bit for each of the 16 slots from pos whose control byte is c
+            unsigned match(size_t pos, signed char c) const
+            {
+                auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&ctrl[pos]));
+                return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c))));
+            }
+
+            // a bit for each of the 16 slots from pos that is empty or deleted,
+            // which are the control bytes with the sign bit set
+            unsigned matchFree(size_t pos) const
+            {
+                auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&ctrl[pos]));
+                return static_cast<unsigned>(_mm_movemask_epi8(bytes));
+            }
+
+            // The probe starts at the slot the hash picks and moves a group
+            // further each time, which with a power of two capacity visits
+            // every group.  A group with an empty slot ends the search, since
+            // the key would have been put there.
+            template <typename K>
+            size_t indexOf(const K& key, size_t h) const
+            {
+                if (slots.empty())
+                    return npos;
+                auto pos = (h >> 7) & mask;
+                for (size_t step = group; ; step += group) {
+                    for (auto bits = match(pos, tag(h)); bits; bits &= bits - 1) {
+                        auto i = (pos + lowestBit(bits)) & mask;
+                        if (hashes[i] == h && Equal()(KeyOf()(slots[i]), key))
+                            return i;
+                    }
+                    if (match(pos, emptySlot))
+                        return npos;
+                    pos = (pos + step) & mask;
+                }
+            }
+
+            size_t findFree(size_t h) const
+            {
+                auto pos = (h >> 7) & mask;
+                for (size_t step = group; ; step += group) {
+                    if (auto bits = matchFree(pos))
+                        return (pos + lowestBit(bits)) & mask;
+                    pos = (pos + step) & mask;
+                }
+            }
+
+            // claims a slot for a new entry with hash h, growing first if the
+            // table is full.  Deleted slots count as used until a rehash, so
+            // reusing one doesn't use up any room.
+            size_t place(size_t h)
+            {
+                if (growthLeft == 0) {
+                    // grow when over half of the load is live entries,
+                    // otherwise the same size is enough to clear the deleted ones
+                    auto capacity = slots.size();
+                    rehash(capacity == 0 ? group : count * 2 > maxLoad(capacity) ? capacity * 2 : capacity);
+                }
+                auto i = findFree(h);
+                if (ctrl[i] == emptySlot)
+                    --growthLeft;
+                setCtrl(i, tag(h));
+                hashes[i] = h;
+                ++count;
+                return i;
+            }
+
+            // The first group of control bytes is repeated past the end, so
+            // a group can be loaded from any slot without wrapping around.
+            void setCtrl(size_t i, signed char c)
+            {
+                ctrl[i] = c;
+                if (i < group)
+                    ctrl[slots.size() + i] = c;
+            }
+
+            void rehash(size_t capacity)
+            {
+                auto oldCtrl = std::move(ctrl);
+                auto oldHashes = std::move(hashes);
+                auto oldSlots = std::move(slots);
+
+                ctrl.assign(capacity + group, emptySlot);
+                hashes.assign(capacity, 0);
+                slots = std::vector<Value>(capacity);
+                mask = capacity - 1;
+                growthLeft = maxLoad(capacity) - count;
+
+                for (size_t i = 0; i < oldSlots.size(); ++i) {
+                    if (oldCtrl[i] >= 0) {
+                        auto j = findFree(oldHashes[i]);
+                        setCtrl(j, oldCtrl[i]);
+                        hashes[j] = oldHashes[i];
+                        slots[j] = std::move(oldSlots[i]);
+                    }
+                }
+            }
+
+            std::vector<signed char> ctrl;  // slots.size() + group
+            std::vector<size_t> hashes;
+            std::vector<Value> slots;
+            size_t mask;        // slots.size() - 1
+            size_t count;
+            size_t growthLeft;  // empty slots that can be used before growing
+        };
+
+        struct FirstOf {
+            template <typename Pair>
+            auto const& operator()(const Pair& p) const { return p.first; }
+        };
+
+        struct Itself {
+            template <typename T>
+            const T& operator()(const T& t) const { return t; }
+        };
+
+        template <typename Key, typename T, typename Hash, typename Equal>
+        using FlatMap = FlatTable<std::pair<Key, T>, FirstOf, Hash, Equal>;
+
+        template <typename Key, typename Hash, typename Equal>
+        using FlatSet = FlatTable<Key, Itself, Hash, Equal>;
+
+    } // namespace util
+} // namespace syncplaylists
@@ -0,0 +1,318 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <windows.h>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include "common.h"
+#include "util.h"
+#include "xxhash.h"
+#include "manifest.h"
+#include "hashcache.h"
+
+// The cache file is
+//
+//   magic, version, record count
+//   records sorted by key (the hash of the location)
+//   checksum of everything before it
+
+namespace syncplaylists {
+    namespace hashcache {
+
+        using namespace std;
+        using namespace common;
+        using namespace util;
+
+        static const unsigned int cache_magic = 0x43485053; // "SPHC"
+        static const unsigned int cache_version = 1;
+        static const size_t header_size = 4 * sizeof(unsigned int);
+
+        static wstring cachePath()
+        {
+            return getAppDataDir() + L"sourcehash.cache";
+        }
+
+        static unsigned long long locationKey(wstring_view location)
+        {
+            return hash::xxh64(location.data(), location.length() * sizeof(wchar_t));
+        }
+
+        SourceHashCache::SourceHashCache() : records(nullptr), count(0)
+        {
+            if (!file.open(cachePath()))
+                return;
+
+            auto data = file.data();
+            auto len = file.size();
+
+            unsigned int header[4];
+            if (len < header_size + sizeof(unsigned long long)) {
+                file.close();
+                return;
+            }
+            ::memcpy(header, data, header_size);
+
+            unsigned long long sum;
+            ::memcpy(&sum, data + len - sizeof(sum), sizeof(sum));
+
+            size_t n = header[2];
+            if (header[0] != cache_magic || header[1] != cache_version ||
+                len != header_size + n * sizeof(Record) + sizeof(sum) ||
+                sum != checksum64(data, len - sizeof(sum))) {
+                file.close();
+                return;
+            }
+
+            // the header is 16 bytes, so the records are 8 byte aligned in the view
+            records = reinterpret_cast<const Record*>(data + header_size);
+            count = n;
+            used.assign(count, false);
+        }
+
+        const SourceHashCache::Record* SourceHashCache::find(unsigned long long key) const
+        {
+            auto end = records + count;
+            auto it = lower_bound(records, end, key, [](const Record& r, unsigned long long k) { return r.key < k; });
+            return it != end && it->key == key ? it : nullptr;
+        }
+
+        bool SourceHashCache::lookup(wstring_view location, unsigned long long size, unsigned long long lastWrite,
+            unsigned long long& hash)
+        {
+            auto r = find(locationKey(location));
+            if (!r || r->size != size || r->lastWrite != lastWrite)
+                return false;
+            used[r - records] = true;
+            hash = r->hash;
+            return true;
+        }
+
+        void SourceHashCache::add(wstring_view location, unsigned long long size, unsigned long long lastWrite,
+            unsigned long long hash)
+        {
+            Record r;
+            r.key = locationKey(location);
+            r.size = size;
+            r.lastWrite = lastWrite;
+            r.hash = hash;
+            added.push_back(r);
+        }
+
+        void SourceHashCache::save()
+        {
+            if (added.empty() && std::find(used.begin(), used.end(), false) == used.end())
+                return;
+
+            auto byKey = [](const Record& a, const Record& b) { return a.key < b.key; };
+
+            sort(added.begin(), added.end(), byKey);
+
+            // new records replace old ones for the same location, and old
+            // ones that weren't used are dropped
+            vector<Record> merged;
+            merged.reserve(count + added.size());
+            size_t i = 0, k = 0;
+            while (i < count || k < added.size()) {
+                if (k == added.size() || (i < count && records[i].key < added[k].key)) {
+                    if (used[i])
+                        merged.push_back(records[i]);
+                    ++i;
+                } else {
+                    if (i < count && records[i].key == added[k].key)
+                        ++i;
+                    merged.push_back(added[k++]);
+                }
+            }
+
+            // the file can't be replaced while it's mapped
+            records = nullptr;
+            count = 0;
+            used.clear();
+            file.close();
+
+            vector<char> data(header_size + merged.size() * sizeof(Record));
+            unsigned int header[4] = { cache_magic, cache_version, static_cast<unsigned int>(merged.size()), 0 };
+            ::memcpy(&data[0], header, header_size);
+            if (!merged.empty())
+                ::memcpy(&data[header_size], &merged[0], merged.size() * sizeof(Record));
+
+            auto sum = checksum64(&data[0], data.size());
+            data.insert(data.end(), reinterpret_cast<const char*>(&sum), reinterpret_cast<const char*>(&sum) + sizeof(sum));
+
+            writeFileAtomic(cachePath(), data);
+
+            added.clear();
+        }
+
+        // returns false if the file can't be read
+        static bool hashSourceFile(const wchar_t* path, vector<char>& buf, unsigned long long& hash)
+        {
+            auto h = ::CreateFile(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (h == INVALID_HANDLE_VALUE)
+                return false;
+
+            hash::XXH64 hasher;
+            bool ok = true;
+            for (;;) {
+                DWORD n;
+                if (!::ReadFile(h, &buf[0], static_cast<DWORD>(buf.size()), &n, nullptr)) {
+                    ok = false;
+                    break;
+                }
+                if (n == 0)
+                    break;
+                hasher.update(&buf[0], n);
+            }
+
+            ::CloseHandle(h);
+
+            hash = hasher.digest();
+            return ok;
+        }
+
+        void addChangedContent(const Library& library,
+            const manifest::Entries_t& entries,
+            unsigned nthreads,
+            vector<TrackId>& tocopy)
+        {
+            vector<bool> copying(library.tracks.size());
+            for (auto id : tocopy) {
+                copying[id] = true;
+            }
+
+            // files already on the device whose manifest entry has a hash
+            struct Candidate {
+                const Track* track;
+                unsigned long long deviceHash;
+                unsigned long long size;
+                unsigned long long lastWrite;
+                unsigned long long sourceHash;
+                bool known;
+            };
+
+            vector<Candidate> candidates;
+
+            for (auto const& e : entries) {
+                if (!e.second.hashed)
+                    continue;
+                auto it = library.files.find(e.first);
+                if (it == library.files.end() || copying[it->second])
+                    continue;
+                Candidate c;
+                c.track = &library.tracks[it->second];
+                c.deviceHash = e.second.hash;
+                c.size = c.track->size;
+                c.lastWrite = c.track->lastWrite;
+                c.sourceHash = 0;
+                c.known = false;
+                candidates.push_back(c);
+            }
+
+            SourceHashCache cache;
+
+            vector<Candidate*> tohash;
+
+            // built for one candidate at a time
+            wstring location;
+
+            for (auto& c : candidates) {
+                getLocation(*c.track, location);
+
+                // the key needs the real size and time
+                if (c.size == 0 || c.lastWrite == 0) {
+                    WIN32_FILE_ATTRIBUTE_DATA attrs;
+                    if (!::GetFileAttributesEx(location.c_str(), GetFileExInfoStandard, &attrs))
+                        continue;
+                    c.size = (static_cast<unsigned long long>(attrs.nFileSizeHigh) << 32) | attrs.nFileSizeLow;
+                    c.lastWrite = (static_cast<unsigned long long>(attrs.ftLastWriteTime.dwHighDateTime) << 32) | attrs.ftLastWriteTime.dwLowDateTime;
+                }
+                if (cache.lookup(location, c.size, c.lastWrite, c.sourceHash))
+                    c.known = true;
+                else
+                    tohash.push_back(&c);
+            }
+
+            if (!tohash.empty()) {
+                printOut(L"hashing " + to_wstring(tohash.size()) + L" source files");
+
+                if (nthreads < 1)
+                    nthreads = 1;
+                if (nthreads > tohash.size())
+                    nthreads = static_cast<unsigned>(tohash.size());
+
+                atomic<size_t> next(0);
+
+                auto worker = [&]() {
+                    vector<char> buf(1024 * 1024);
+                    wstring path;
+                    for (auto i = next++; i < tohash.size(); i = next++) {
+                        getLocation(*tohash[i]->track, path);
+                        tohash[i]->known = hashSourceFile(path.c_str(), buf, tohash[i]->sourceHash);
+                    }
+                };
+
+                vector<thread> threads;
+                for (unsigned i = 0; i < nthreads; ++i) {
+                    threads.emplace_back(worker);
+                }
+                for (auto& t : threads) {
+                    t.join();
+                }
+
+                for (auto c : tohash) {
+                    if (c->known) {
+                        getLocation(*c->track, location);
+                        cache.add(location, c->size, c->lastWrite, c->sourceHash);
+                    }
+                }
+            }
+
+            // also prunes the records of songs that weren't looked up
+            cache.save();
+
+            for (auto const& c : candidates) {
+                if (c.known && c.sourceHash != c.deviceHash)
+                    tocopy.push_back(c.track->id);
+            }
+        }
+
+    } // namespace hashcache
+} // namespace syncplaylists
@@ -0,0 +1,91 @@
+#pragma once
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "common.h"
+#include "manifest.h"
+
+namespace syncplaylists {
+    namespace hashcache {
+
+        // Content hashes of source files, kept in the app data directory
+        // between runs.  Records are keyed by location, size and last write
+        // time, so a file is only hashed again when it changes.  The file is
+        // a sorted array of fixed-size records that's mapped and binary
+        // searched rather than loaded.  Only songs whose manifest entry has
+        // a hash are compared, which means songs copied by the blocks
+        // backend, so the cache does nothing for the other backends.
+        class SourceHashCache {
+        public:
+            SourceHashCache();
+
+            // returns false if there's no record for this location with this
+            // size and time.  A record that's found is kept by save.
+            bool lookup(std::wstring_view location, unsigned long long size, unsigned long long lastWrite,
+                unsigned long long& hash);
+
+            // adds or replaces a record, kept in memory until save
+            void add(std::wstring_view location, unsigned long long size, unsigned long long lastWrite,
+                unsigned long long hash);
+
+            // Rewrites the file with the records looked up or added since it
+            // was opened.  The others are for files that were moved, deleted
+            // or changed, or aren't in the playlists any more, and are dropped
+            // so the cache doesn't grow forever.
+            void save();
+
+        private:
+            struct Record {
+                unsigned long long key; // XXH64 of the location
+                unsigned long long size;
+                unsigned long long lastWrite;
+                unsigned long long hash;
+            };
+
+            const Record* find(unsigned long long key) const;
+
+            util::MappedFile file;
+            const Record* records;
+            size_t count;
+            std::vector<bool> used; // by index in records
+            std::vector<Record> added;
+        };
+
+        // Adds to tocopy the files that are on the device with the right size
+        // but whose source content differs from the hash in the manifest.
+        // Source hashes come from the cache, and the ones that are missing
+        // are computed nthreads at a time.
+        void addChangedContent(const common::Library& library,
+            const manifest::Entries_t& entries,
+            unsigned nthreads,
+            std::vector<common::TrackId>& tocopy);
+
+    } // namespace hashcache
+} // namespace syncplaylists
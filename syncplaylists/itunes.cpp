@@ -31,13 +31,20 @@ THE SOFTWARE.
 #include <windows.h>
 #include <atlbase.h>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <cstdint>
 #include <unordered_map>
 #include <unordered_set>
 #include <memory>
+#include <functional>
+#include <utility>
 
 #include "common.h"
 #include "util.h"
 #include "comhelper.h"
+#include "snapshot.h"
 
 #include "iTunesCOMInterface.h"
 
@@ -49,10 +56,150 @@ namespace syncplaylists {
         using namespace common;
         using namespace commhelper;
 
-        void getPlaylists(const unordered_set<wstring>& sync_playlists,
-            ItunesPlaylists_t& initunes,
-            ItunesFiles_t& itunesfiles)
+        // iTunes reports dates as local time
+        static unsigned long long dateToTicks(DATE date)
         {
+            SYSTEMTIME st;
+            FILETIME local, utc;
+            if (!::VariantTimeToSystemTime(date, &st) ||
+                !::SystemTimeToFileTime(&st, &local) ||
+                !::LocalFileTimeToFileTime(&local, &utc)) {
+                return 0;
+            }
+            return (static_cast<unsigned long long>(utc.dwHighDateTime) << 32) | utc.dwLowDateTime;
+        }
+
+        // Every call on an iTunes interface is a round trip to the iTunes
+        // process.  They're counted so --stats can show the calls per track.
+        static unsigned long long rpcCount;
+
+        static HRESULT rpc(HRESULT hRes)
+        {
+            ++rpcCount;
+            return hRes;
+        }
+
+        // returns null if the track isn't a file that can be copied
+        static const Track* getTrack(IITTrack* gt, long id, long i, const wstring& plname, const Options& opts,
+            Library& library)
+        {
+            // only file and CD tracks have IITFileOrCDTrack, so this
+            // also does the job of checking the kind
+            ComInterfaceWrapper<IITFileOrCDTrack> ft;
+            auto hRes = rpc(gt->QueryInterface(IID_IITFileOrCDTrack, reinterpret_cast<void**>(&ft.iface)));
+            if (hRes == E_NOINTERFACE) {
+                return nullptr;
+            }
+            throwIfNotOk(hRes, [&] { return L"failed to get filetrack for item " + to_wstring(i) + L" in " + plname; });
+
+            // the name is only needed for error messages
+            auto songName = [&]() -> wstring {
+                CComBSTR name;
+                if (ft.iface->get_Name(&name) == S_OK && name.Length() > 0)
+                    return name.m_str;
+                return L"at index " + to_wstring(i);
+            };
+
+            CComBSTR loc;
+            hRes = rpc(ft.iface->get_Location(&loc));
+            if (hRes != S_OK) {
+                fail(L"failed to get location for song " + songName() + L" in playlist " + plname, hRes);
+            }
+
+            // CD tracks, and tracks whose file is missing, have no location
+            if (loc.Length() == 0) {
+                printErr(L"skipping song " + songName() + L" in playlist " + plname + L", it has no file");
+                return nullptr;
+            }
+
+            wstring_view location(loc.m_str, loc.Length());
+            auto filename = getFilename(location);
+
+            if (equalsIgnoreCase(getExtension(filename), L"m4p")) {
+                printErr(L"skipping protected file " + wstring(filename));
+                return nullptr;
+            }                                      
+
+            auto& track = library.addTrack(id, location);
+
+            // not needed if they're going to come from the filesystem anyway.
+            // size 0 makes disk::getFilesToCopy stat the file itself
+            if (!opts.trustFs) {
+                long size;
+                if (rpc(ft.iface->get_Size(&size)) == S_OK && size > 0)
+                    track.size = static_cast<unsigned long long>(size);
+
+                DATE modified;
+                if (rpc(ft.iface->get_ModificationDate(&modified)) == S_OK)
+                    track.lastWrite = dateToTicks(modified);
+            }
+
+            return &track;
+        }
+
+        // adds a playlist from the snapshot, sharing tracks with the ones already seen
+        static void addSnapshotPlaylist(const wstring& plname,
+            const snapshot::Snapshot& cached,
+            unordered_map<long, const Track*>& seen,
+            Library& library,
+            const TrackCallback& onTrack)
+        {
+            auto const& cachedSongs = cached.library.playlists.find(plname)->second;
+
+            auto& songs = library.playlists[plname];
+            songs.reserve(cachedSongs.size());
+
+            wstring location;
+
+            for (auto id : cachedSongs) {
+                auto const& from = cached.library.tracks[id];
+                auto& track = seen[from.databaseId];
+                if (!track) {
+                    getLocation(from, location);
+                    auto& added = library.addTrack(from.databaseId, location);
+                    added.size = from.size;
+                    added.lastWrite = from.lastWrite;
+                    track = &added;
+                    if (onTrack)
+                        onTrack(added);
+                }
+                songs.push_back(track->id);
+            }
+        }
+
+        // used when iTunes isn't available.  All the playlists must be in the snapshot.
+        static void getPlaylistsFromSnapshot(const PlaylistNames_t& sync_playlists,
+            const snapshot::Snapshot& cached,
+            Library& library,
+            const TrackCallback& onTrack)
+        {
+            for (auto const& plname : sync_playlists) {
+                throwIfFalse(cached.library.playlists.find(plname) != cached.library.playlists.end(),
+                    [&] { return L"playlist " + plname + L" is not in the saved snapshot"; });
+            }
+
+            unordered_map<long, const Track*> seen;
+
+            for (auto const& plname : sync_playlists) {
+                addSnapshotPlaylist(plname, cached, seen, library, onTrack);
+            }
+        }
+
+        void getPlaylists(const PlaylistNames_t& sync_playlists,
+            const Options& opts,
+            Library& library,
+            const TrackCallback& onTrack)
+        {
+            // the playlists as of the last run.  --refresh ignores it.
+            snapshot::Snapshot cached;
+            bool haveSnapshot = !opts.refresh && snapshot::load(cached);
+
+            if (opts.offline) {
+                throwIfFalse(haveSnapshot, L"--offline needs a saved snapshot, and there isn't one");
+                getPlaylistsFromSnapshot(sync_playlists, cached, library, onTrack);
+                return;
+            }
+
             ComInitializer comInit; // constructor calls ::CoInitialize()      
 
             ComInterfaceWrapper<IiTunes> itunes;
@@ -60,96 +207,173 @@ namespace syncplaylists {
             // note - CLSID_iTunesApp and IID_IiTunes are defined in iTunesCOMInterface_i.c
             auto hRes = ::CoCreateInstance(CLSID_iTunesApp, NULL, CLSCTX_LOCAL_SERVER, IID_IiTunes, (PVOID*)&itunes.iface);
 
-            throwIfFalse(hRes == S_OK, L"failed to connect to iTunes COM server");
+            if (hRes != S_OK && haveSnapshot) {
+                printErr(L"failed to connect to iTunes COM server, using the playlists saved by the last run");
+                getPlaylistsFromSnapshot(sync_playlists, cached, library, onTrack);
+                return;
+            }
+
+            throwIfNotOk(hRes, L"failed to connect to iTunes COM server");
+
+            rpcCount = 0;
+            unsigned long long ntracks = 0;
+            unsigned long long nreused = 0;
+
+            // by TrackDatabaseID, null for tracks that are skipped
+            unordered_map<long, const Track*> seen;
+
+            // saved with the library for the next run
+            snapshot::Fingerprints_t fingerprints;
+
+            // of the playlist being read
+            vector<long> ids;
+
+            // the items of the playlist being read whose tracks weren't seen
+            // yet, kept from the pass that reads the IDs
+            vector<ComInterfaceWrapper<IITTrack> > items;
+
+            // adds the item to songs, reading the track unless it's been seen
+            auto addItem = [&](IITTrack* gt, long id, long i, const wstring& plname, vector<TrackId>& songs) {
+                const Track* track;
+                auto found = seen.find(id);
+                if (found != seen.end()) {
+                    track = found->second;
+                } else {
+                    track = getTrack(gt, id, i, plname, opts, library);
+                    seen[id] = track;
+                    if (track && onTrack)
+                        onTrack(*track);
+                }
+
+                // null if it's not a file we can copy
+                if (track)
+                    songs.push_back(track->id);
+            };
 
             ComInterfaceWrapper<IITSourceCollection> iSources;
 
-            hRes = itunes.iface->get_Sources(&iSources.iface);
+            hRes = rpc(itunes.iface->get_Sources(&iSources.iface));
 
-            throwIfFalse(hRes == S_OK, L"failed to get sources");
+            throwIfNotOk(hRes, L"failed to get sources");
 
             CComBSTR srclibname(L"Library");
 
-            ComInterfaceWrapper<IITSource> library;
+            ComInterfaceWrapper<IITSource> source;
 
-            hRes = iSources.iface->get_ItemByName(srclibname.m_str, &library.iface);
+            hRes = rpc(iSources.iface->get_ItemByName(srclibname.m_str, &source.iface));
 
-            throwIfFalse(hRes == S_OK, L"failed to get library");
+            throwIfNotOk(hRes, L"failed to get library");
 
             ComInterfaceWrapper<IITPlaylistCollection> playlists;
 
-            hRes = library.iface->get_Playlists(&playlists.iface);
+            hRes = rpc(source.iface->get_Playlists(&playlists.iface));
 
-            throwIfFalse(hRes == S_OK, L"failed to get playlists");
+            throwIfNotOk(hRes, L"failed to get playlists");
 
             for (auto const& plname : sync_playlists) {
                 CComBSTR bplname(plname.c_str());
                 ComInterfaceWrapper<IITPlaylist> pl;
-                hRes = playlists.iface->get_ItemByName(bplname.m_str, &pl.iface);
-                throwIfFalse(hRes == S_OK, L"failed to get playist " + plname);
+                hRes = rpc(playlists.iface->get_ItemByName(bplname.m_str, &pl.iface));
+                throwIfNotOk(hRes, [&] { return L"failed to get playist " + plname; });
 
                 ITPlaylistKind plkind;
 
-                hRes = pl.iface->get_Kind(&plkind);
-                throwIfFalse(hRes == S_OK, L"failed to get playist kind for " + plname);
+                hRes = rpc(pl.iface->get_Kind(&plkind));
+                throwIfNotOk(hRes, [&] { return L"failed to get playist kind for " + plname; });
 
                 if (plkind != ITPlaylistKindUser) {
                     continue;
                 }
 
                 ComInterfaceWrapper<IITTrackCollection> tracks;
-                hRes = pl.iface->get_Tracks(&tracks.iface);
-                throwIfFalse(hRes == S_OK, L"failed to get tracks for " + plname);
+                hRes = rpc(pl.iface->get_Tracks(&tracks.iface));
+                throwIfNotOk(hRes, [&] { return L"failed to get tracks for " + plname; });
 
                 long count;
 
-                hRes = tracks.iface->get_Count(&count);
+                hRes = rpc(tracks.iface->get_Count(&count));
+
+                throwIfNotOk(hRes, [&] { return L"failed to get count for " + plname; });
+
+                ntracks += count;
+
+                snapshot::Fingerprint fp;
+                fp.count = count;
+
+                hRes = rpc(pl.iface->get_Size(&fp.size));
+                throwIfNotOk(hRes, [&] { return L"failed to get size of " + plname; });
+
+                hRes = rpc(pl.iface->get_Duration(&fp.duration));
+                throwIfNotOk(hRes, [&] { return L"failed to get duration of " + plname; });
 
-                throwIfFalse(hRes == S_OK, L"failed to get count for " + plname);
+                // Only a playlist whose count, size and duration match the
+                // snapshot can be unchanged, and then the IDs decide.  Any
+                // other is read in one pass, so onTrack sees each track as
+                // soon as it's read.
+                auto prev = cached.fingerprints.find(plname);
+                bool mayReuse = prev != cached.fingerprints.end() && prev->second.count == fp.count &&
+                    prev->second.size == fp.size && prev->second.duration == fp.duration;
+
+                vector<TrackId>* songs = nullptr;
+                if (!mayReuse) {
+                    songs = &library.playlists[plname];
+                    songs->reserve(count);
+                }
+
+                // the database IDs in play order.  Indices are 1-based.
+                // Getting the items by play order means we don't have to ask
+                // for each one's play order.
+                ids.resize(count);
+                items.clear();
+                items.resize(mayReuse ? count : 0);
 
                 for (long i = 0; i < count; ++i) {
                     ComInterfaceWrapper<IITTrack> gt;
-                    // indices are 1-based
-                    hRes = tracks.iface->get_Item(i + 1, &gt.iface);
-                    throwIfFalse(hRes == S_OK, L"failed to get item " + to_wstring(i) + L" in " + plname);                    
-                    ITTrackKind tkind;
-                    hRes = gt.iface->get_Kind(&tkind);                    
-                    throwIfFalse(hRes == S_OK, L"failed to get track kind for item " + to_wstring(i) + L" in playist " + plname);
-                    if (tkind != ITTrackKindFile) {
-                        continue;
-                    }
-                    ComInterfaceWrapper<IITFileOrCDTrack> ft;
-                    hRes = gt.iface->QueryInterface(IID_IITFileOrCDTrack, reinterpret_cast<void**>(&ft.iface));
-                    throwIfFalse(hRes == S_OK, L"failed to get filetrack for item " + to_wstring(i) + L" in " + plname);                    
-
-                    Song song;               
-
-                    CComBSTR name;
-                    hRes = ft.iface->get_Name(&name);
-
-                    // we can proceed without the name if we don't get it
-                    if (hRes == S_OK) {
-                        song.name = name;
-                    }
-
-                    CComBSTR loc;
-                    hRes = ft.iface->get_Location(&loc);
-                    throwIfFalse(hRes == S_OK, L"failed to get location for song " + (song.name.length() > 0 ? song.name : L"at index " + to_wstring(i)) + L" in playlist " + plname);
-
-                    song.filename = getFilename(loc.m_str);
-
-                    if (::lstrcmpi(getExtension(song.filename).c_str(), L"m4p") == 0) {
-                        printErr(L"skipping protected file " + song.filename);
-                        continue;
-                    }                                      
-
-                    hRes = ft.iface->get_PlayOrderIndex(&song.order);
-                    throwIfFalse(hRes == S_OK, L"unable to get play order index for song " + (song.name.length() > 0 ? song.name : song.filename) + L" in playlist " + plname);
-
-                    itunesfiles[song.filename] = loc.m_str;
-
-                    initunes[plname].emplace_back(song);
+                    hRes = rpc(tracks.iface->get_ItemByPlayOrder(i + 1, &gt.iface));
+                    throwIfNotOk(hRes, [&] { return L"failed to get item " + to_wstring(i) + L" in " + plname; });
+
+                    hRes = rpc(gt.iface->get_TrackDatabaseID(&ids[i]));
+                    throwIfNotOk(hRes, [&] { return L"failed to get database ID for item " + to_wstring(i) + L" in " + plname; });
+
+                    // tracks already seen in another playlist cost no more
+                    // calls, so only the unseen items are kept
+                    if (!mayReuse)
+                        addItem(gt.iface, ids[i], i, plname, *songs);
+                    else if (seen.find(ids[i]) == seen.end())
+                        std::swap(items[i].iface, gt.iface);
                 }
+
+                fp.ids = ids.empty() ? 0 : checksum64(&ids[0], ids.size() * sizeof(ids[0]));
+
+                fingerprints[plname] = fp;
+
+                if (!mayReuse)
+                    continue;
+
+                // unchanged since the last run, so the tracks' details come
+                // from the snapshot
+                if (prev->second == fp) {
+                    addSnapshotPlaylist(plname, cached, seen, library, onTrack);
+                    nreused += count;
+                    continue;
+                }
+
+                // changed after all.  The items kept from the first pass
+                // are read without fetching them again.
+                songs = &library.playlists[plname];
+                songs->reserve(count);
+
+                for (long i = 0; i < count; ++i) {
+                    addItem(items[i].iface, ids[i], i, plname, *songs);
+                }
+            }
+
+            snapshot::save(library, fingerprints);
+
+            if (opts.stats && ntracks > 0) {
+                printOut(L"made " + to_wstring(rpcCount) + L" calls to iTunes for " + to_wstring(ntracks) + L" tracks (" +
+                    to_wstring(static_cast<double>(rpcCount) / ntracks) + L" per track)");
+                printOut(L"reused " + to_wstring(nreused) + L" tracks from unchanged playlists");
             }
         }
 
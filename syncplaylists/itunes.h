@@ -33,8 +33,9 @@ THE SOFTWARE.
 
 namespace syncplaylists {
     namespace itunes {
-        void getPlaylists(const std::unordered_set<std::wstring>& sync_playlists,
-            common::ItunesPlaylists_t& initunes,
-            common::ItunesFiles_t& initunesflat);
+        void getPlaylists(const common::PlaylistNames_t& sync_playlists,
+            const common::Options& opts,
+            common::Library& library,
+            const common::TrackCallback& onTrack = nullptr);
     } // namespace itunes
 } // namespace syncplaylists
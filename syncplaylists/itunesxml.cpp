@@ -0,0 +1,125 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <windows.h>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdio>
+#include <exception>
+
+#include "common.h"
+#include "util.h"
+#include "plist.h"
+#include "itunesxml.h"
+
+// The parsing is done by plist, which is portable.  This opens or maps the
+// file and adds what it found to the library.
+
+namespace syncplaylists {
+    namespace itunesxml {
+
+        using namespace std;
+        using namespace common;
+        using namespace util;
+
+        static void addSelection(const plist::Selection& selection, Library& library)
+        {
+            for (auto const& why : selection.skipped) {
+                printErr(why);
+            }
+
+            vector<TrackId> ids;
+            ids.reserve(selection.tracks.size());
+
+            for (auto const& xt : selection.tracks) {
+                auto& track = library.addTrack(xt.id, xt.location);
+                track.size = xt.size;
+                track.lastWrite = xt.lastWrite;
+                ids.push_back(track.id);
+            }
+
+            for (auto const& pl : selection.playlists) {
+                auto& songs = library.playlists[pl.name];
+                songs.reserve(pl.tracks.size());
+                for (auto i : pl.tracks) {
+                    songs.push_back(ids[i]);
+                }
+            }
+        }
+
+        void getPlaylists(const wstring& xmlpath,
+            unsigned threads,
+            const PlaylistNames_t& sync_playlists,
+            Library& library)
+        {
+            vector<wstring> wanted;
+            for (auto const& plname : sync_playlists) {
+                wanted.push_back(plname);
+            }
+
+            plist::Selection selection;
+
+            try {
+                MappedFile mapped;
+
+                // with more than one thread, parse the mapped file in place
+                if (threads > 1 && mapped.open(xmlpath)) {
+                    plist::parse(string_view(mapped.data(), mapped.size()), threads, xmlpath, wanted, selection);
+                } else {
+                    auto open_file = [](const wstring& path) -> FILE* {
+                        FILE* f;
+                        if (::_wfopen_s(&f, path.c_str(), L"rb") == 0)
+                            return f;
+                        else
+                            return static_cast<FILE*>(nullptr);
+                    };
+
+                    auto close_file = [](FILE* fl) {if (fl) ::fclose(fl); };
+
+                    unique_ptr <FILE, decltype(close_file)>  fl(open_file(xmlpath), close_file);
+
+                    throwIfFalse(fl.get() != nullptr, [&] { return L"unable to open " + xmlpath; });
+
+                    plist::parse(fl.get(), xmlpath, wanted, selection);
+                }
+            } catch (const plist::ParseError& e) {
+                fail(e.message());
+            }
+
+            addSelection(selection, library);
+        }
+
+    } // namespace itunesxml
+} // namespace syncplaylists
@@ -0,0 +1,275 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <string_view>
+#include <deque>
+#include <cstdint>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <algorithm>
+
+#include "common.h"
+#include "util.h"
+#include "binio.h"
+#include "journal.h"
+
+// The journal file is
+//
+//   magic, version, plan length
+//   the plan: playlist names, files to delete, tracks to copy (filename,
+//       location, size, last write time), then each playlist's songs as
+//       filenames in play order
+//   checksum of everything before it
+//   then one record for each completed step: kind, index, check
+//
+// The records are appended with write through as the sync goes.  A record
+// that was torn by the device being pulled fails its check and ends the list.
+
+namespace syncplaylists {
+    namespace journal {
+
+        using namespace std;
+        using namespace common;
+        using namespace util;
+        using namespace binio;
+
+        static const wchar_t* const journal_name = L"syncplaylists.journal";
+
+        static const unsigned int journal_magic = 0x4a4e5053; // "SPNJ"
+        static const unsigned int journal_version = 1;
+        static const unsigned int record_check = 0x5a5a5a5a;
+
+        Journal::~Journal()
+        {
+            // left in place if the sync didn't finish, so the next run can resume
+            if (file != INVALID_HANDLE_VALUE)
+                ::CloseHandle(file);
+        }
+
+        void Journal::begin(const wstring& usbroot,
+            const vector<wstring>& playlists,
+            const vector<wstring>& todelete,
+            const vector<TrackId>& tocopy,
+            const Library& library)
+        {
+            path = usbroot + journal_name;
+
+            BinWriter wr;
+            wr.putU32(journal_magic);
+            wr.putU32(journal_version);
+            auto lenPos = wr.size();
+            wr.putU32(0);
+
+            wr.putU32(static_cast<unsigned int>(playlists.size()));
+            for (auto const& name : playlists) {
+                wr.putStr(name);
+            }
+
+            wr.putU32(static_cast<unsigned int>(todelete.size()));
+            for (auto const& name : todelete) {
+                wr.putStr(name);
+            }
+
+            wstring location;
+
+            wr.putU32(static_cast<unsigned int>(tocopy.size()));
+            for (auto id : tocopy) {
+                auto const& track = library.tracks[id];
+                getLocation(track, location);
+                wr.putStr(track.filename);
+                wr.putStr(location);
+                wr.putU64(track.size);
+                wr.putU64(track.lastWrite);
+            }
+
+            wr.putU32(static_cast<unsigned int>(library.playlists.size()));
+            for (auto const& pl : library.playlists) {
+                wr.putStr(pl.first);
+                wr.putU32(static_cast<unsigned int>(pl.second.size()));
+                for (auto id : pl.second) {
+                    wr.putStr(library.tracks[id].filename);
+                }
+            }
+
+            wr.patchU32(lenPos, static_cast<unsigned int>(wr.size()));
+
+            auto sum = checksum64(&wr.bytes()[0], wr.size());
+            wr.putU64(sum);
+
+            writeFileAtomic(path, wr.bytes());
+
+            file = ::CreateFile(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_FLAG_WRITE_THROUGH, nullptr);
+            throwLastErrorIfFalse(file != INVALID_HANDLE_VALUE, [&] { return L"unable to open " + path; });
+        }
+
+        void Journal::reopen(const wstring& usbroot)
+        {
+            path = usbroot + journal_name;
+
+            file = ::CreateFile(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_FLAG_WRITE_THROUGH, nullptr);
+            throwLastErrorIfFalse(file != INVALID_HANDLE_VALUE, [&] { return L"unable to open " + path; });
+        }
+
+        void Journal::append(unsigned int kind, size_t index)
+        {
+            unsigned int rec[3];
+            rec[0] = kind;
+            rec[1] = static_cast<unsigned int>(index);
+            rec[2] = kind ^ rec[1] ^ record_check;
+
+            lock_guard<mutex> lock(mtx);
+
+            DWORD n;
+            throwLastErrorIfFalse(::WriteFile(file, rec, sizeof(rec), &n, nullptr) && n == sizeof(rec), [&] { return L"unable to write to " + path; });
+        }
+
+        void Journal::finish()
+        {
+            if (path.empty())
+                return;
+            if (file != INVALID_HANDLE_VALUE) {
+                ::CloseHandle(file);
+                file = INVALID_HANDLE_VALUE;
+            }
+            throwLastErrorIfFalse(::DeleteFile(path.c_str()) != FALSE, [&] { return L"unable to delete " + path; });
+        }
+
+        void Journal::discard(const wstring& usbroot)
+        {
+            ::DeleteFile((usbroot + journal_name).c_str());
+        }
+
+        bool Journal::load(const wstring& usbroot, Plan& plan, Progress& progress)
+        {
+            vector<char> data;
+            if (!readFile(usbroot + journal_name, data))
+                return false;
+
+            BinReader hdr(data.empty() ? nullptr : &data[0], data.size());
+            unsigned int magic, version, planLen;
+            if (!hdr.getU32(magic) || magic != journal_magic || !hdr.getU32(version) || version != journal_version ||
+                !hdr.getU32(planLen) || planLen + sizeof(unsigned long long) > data.size())
+                return false;
+
+            unsigned long long sum;
+            ::memcpy(&sum, &data[planLen], sizeof(sum));
+            if (sum != checksum64(&data[0], planLen))
+                return false;
+
+            // the header has already been read from the plan
+            BinReader rd(&data[0], planLen);
+            rd.getU32(magic);
+            rd.getU32(version);
+            rd.getU32(planLen);
+
+            unsigned int n;
+
+            if (!rd.getU32(n))
+                return false;
+            plan.playlists.resize(n);
+            for (auto& name : plan.playlists) {
+                if (!rd.getStr(name))
+                    return false;
+            }
+
+            if (!rd.getU32(n))
+                return false;
+            plan.todelete.resize(n);
+            for (auto& name : plan.todelete) {
+                if (!rd.getStr(name))
+                    return false;
+            }
+
+            // the filename of a track being copied is the end of its location
+            wstring filename, location;
+
+            if (!rd.getU32(n))
+                return false;
+            plan.tocopy.resize(n);
+            for (auto& id : plan.tocopy) {
+                unsigned long long size, lastWrite;
+                if (!rd.getStr(filename) || !rd.getStr(location) || !rd.getU64(size) || !rd.getU64(lastWrite))
+                    return false;
+                auto& track = plan.library.addTrack(0, location);
+                track.size = size;
+                track.lastWrite = lastWrite;
+                id = track.id;
+            }
+
+            // the playlists refer to the tracks by filename
+            if (!rd.getU32(n))
+                return false;
+            for (unsigned int i = 0; i < n; ++i) {
+                wstring name;
+                unsigned int nsongs;
+                if (!rd.getStr(name) || !rd.getU32(nsongs))
+                    return false;
+                auto& songs = plan.library.playlists[name];
+                songs.reserve(nsongs);
+                for (unsigned int k = 0; k < nsongs; ++k) {
+                    if (!rd.getStr(filename))
+                        return false;
+                    auto found = plan.library.files.find(filename);
+                    if (found != plan.library.files.end()) {
+                        songs.push_back(found->second);
+                    } else {
+                        // already on the device, so only the name is needed
+                        songs.push_back(plan.library.addTrackByName(filename).id);
+                    }
+                }
+            }
+
+            if (!rd.atEnd())
+                return false;
+
+            progress.deleted.assign(plan.todelete.size(), false);
+            progress.copied.assign(plan.tocopy.size(), false);
+
+            BinReader recs(&data[0] + planLen + sizeof(sum), data.size() - planLen - sizeof(sum));
+            unsigned int rec[3];
+            while (recs.get(rec, sizeof(rec)) && rec[2] == (rec[0] ^ rec[1] ^ record_check)) {
+                if (rec[0] == 0 && rec[1] < progress.deleted.size())
+                    progress.deleted[rec[1]] = true;
+                else if (rec[0] == 1 && rec[1] < progress.copied.size())
+                    progress.copied[rec[1]] = true;
+            }
+
+            return true;
+        }
+
+    } // namespace journal
+} // namespace syncplaylists
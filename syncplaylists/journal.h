@@ -0,0 +1,100 @@
+#pragma once
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "common.h"
+
+namespace syncplaylists {
+    namespace journal {
+
+        // everything a sync is going to do to the device, decided before it
+        // changes anything
+        struct Plan {
+            std::vector<std::wstring> playlists; // the selected playlists
+            std::vector<std::wstring> todelete;
+            std::vector<common::TrackId> tocopy;
+            // What the .m3u files will list.  Only the tracks in tocopy have
+            // a location; the others are already on the device.
+            common::Library library;
+        };
+
+        // What's done so far, by index into the plan's todelete and tocopy
+        struct Progress {
+            std::vector<bool> deleted;
+            std::vector<bool> copied;
+        };
+
+        // The journal is the plan, written to the device before the sync
+        // starts, followed by a small record for each delete and copy as it
+        // completes.  If the sync is interrupted, the next run can finish it
+        // from the journal without iTunes or a scan of the device.
+        class Journal {
+        public:
+            Journal() : file(INVALID_HANDLE_VALUE) {}
+            ~Journal();
+
+            // writes the plan to the device and opens the journal for appending
+            void begin(const std::wstring& usbroot,
+                const std::vector<std::wstring>& playlists,
+                const std::vector<std::wstring>& todelete,
+                const std::vector<common::TrackId>& tocopy,
+                const common::Library& library);
+
+            // opens a loaded journal for appending, to carry on where it stopped
+            void reopen(const std::wstring& usbroot);
+
+            // records that todelete[index] or tocopy[index] is done.  Thread safe.
+            void deleted(size_t index) { append(0, index); }
+            void copied(size_t index) { append(1, index); }
+
+            // the sync is complete, so the journal is removed.  Does nothing
+            // if begin or reopen wasn't called.
+            void finish();
+
+            // returns false if there is no journal or its plan isn't valid
+            static bool load(const std::wstring& usbroot, Plan& plan, Progress& progress);
+
+            // removes the journal without finishing it
+            static void discard(const std::wstring& usbroot);
+
+        private:
+            void append(unsigned int kind, size_t index);
+
+            std::wstring path;
+            HANDLE file;
+            std::mutex mtx;
+
+            // disallow copying
+            Journal(Journal const&) = delete;
+            void operator=(Journal const&) = delete;
+        };
+
+    } // namespace journal
+} // namespace syncplaylists
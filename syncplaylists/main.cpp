@@ -30,6 +30,17 @@ THE SOFTWARE.
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <string_view>
+#include <cstdint>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <clocale>
 #include <unordered_set>
 #include <unordered_map>
@@ -40,6 +51,12 @@ THE SOFTWARE.
 
 #include "util.h"
 #include "itunes.h"
+#include "itunesxml.h"
+#include "pipeline.h"
+#include "manifest.h"
+#include "copier.h"
+#include "hashcache.h"
+#include "journal.h"
 #include "disk.h"
 
 using namespace std;
@@ -50,6 +67,135 @@ using namespace syncplaylists::disk;
 using namespace syncplaylists::itunes;
 
 
+static void printUsage(const wchar_t* argv0)
+{
+    wstring prodName, prodVer, prodCopyright;
+    if (GetProductVersionInfo(prodName, prodVer, prodCopyright)) {
+        printErr(prodName + L" version " + prodVer + L" " + prodCopyright);
+    }
+    printErr(L"usage: " + wstring(argv0) + L" [options] usbrootdir playlist1 playlist2...");
+    printErr(L"       " + wstring(argv0) + L" --verify usbrootdir");
+    printErr(L"options:");
+    printErr(L"  --stats      report how long each phase takes");
+    printErr(L"  --trust-fs   get source file sizes from the filesystem instead of iTunes");
+    printErr(L"  --xml file   read playlists from an iTunes Library.xml file instead of from iTunes");
+    printErr(L"  --threads n  use n threads to parse the XML file (default 1, reading it as a stream)");
+    printErr(L"  --refresh    get every playlist from iTunes, even ones that haven't changed,");
+    printErr(L"               and start over instead of finishing an interrupted sync");
+    printErr(L"  --offline    use the playlists saved by the last run instead of iTunes");
+    printErr(L"  --pipeline   start copying while the playlists are still being read");
+    printErr(L"  --copies n   copy n files at the same time (default 4)");
+    printErr(L"  --copy-backend copyfile|copyfile2|blocks");
+    printErr(L"               copy with CopyFile, with CopyFile2 without buffering, or in large");
+    printErr(L"               overlapped blocks (the default, and the only one that hashes)");
+    printErr(L"  --block-size n  block size in MB for the blocks backend, 1 to 16 (default 4)");
+    printErr(L"  --unbuffered copy without going through the system cache (blocks backend)");
+    printErr(L"  --verify-extents  report how fragmented the synced files are on the device");
+    printErr(L"               (only the blocks backend reserves space to avoid fragments)");
+    printErr(L"  --verify     re-read the files on the device and check them against its manifest");
+    printErr(L"  --content-compare  also copy songs whose contents changed but not their size");
+    printErr(L"  --order none|largest|path|playlist");
+    printErr(L"               copy in no particular order, largest first, by source path (the");
+    printErr(L"               default), or playlist by playlist in command-line order");
+    printErr(L"  --rescan     scan the device even if its manifest says nothing has changed,");
+    printErr(L"               and start over instead of finishing an interrupted sync");
+    printErr(L"example:");
+    printErr(wstring(argv0) + L" e:\\ EDM Rap Rock Pop");
+}
+
+static void reportPhase(const Options& opts, const wstring& phase, Stopwatch& sw)
+{
+    if (opts.stats) {
+        printOut(phase + L" took " + to_wstring(sw.seconds()) + L" seconds");
+    }
+    sw.reset();
+}
+
+// the files on the device that a sync is about to delete or replace
+static vector<wstring> changingFiles(const Library& library, const vector<wstring>& todelete, const vector<TrackId>& tocopy)
+{
+    vector<wstring> changing(todelete);
+    for (auto id : tocopy) {
+        changing.emplace_back(library.tracks[id].filename);
+    }
+    return changing;
+}
+
+// finishes a sync that was interrupted, from its journal, without iTunes or a scan
+static void finishSync(const wstring& usbroot, const Options& opts,
+    const syncplaylists::journal::Plan& plan, const syncplaylists::journal::Progress& progress)
+{
+    syncplaylists::journal::Journal journal;
+    journal.reopen(usbroot);
+
+    Stopwatch sw;
+
+    // what's left, and where each one is in the plan
+    vector<wstring> todelete;
+    vector<size_t> deleteIndexes;
+    for (size_t i = 0; i < plan.todelete.size(); ++i) {
+        if (!progress.deleted[i]) {
+            todelete.push_back(plan.todelete[i]);
+            deleteIndexes.push_back(i);
+        }
+    }
+
+    vector<TrackId> tocopy;
+    vector<size_t> copyIndexes;
+    for (size_t i = 0; i < plan.tocopy.size(); ++i) {
+        if (!progress.copied[i]) {
+            tocopy.push_back(plan.tocopy[i]);
+            copyIndexes.push_back(i);
+        }
+    }
+
+    syncplaylists::manifest::invalidate(usbroot, changingFiles(plan.library, todelete, tocopy));
+
+    deleteFiles(usbroot, todelete, [&](size_t i) { journal.deleted(deleteIndexes[i]); });
+    reportPhase(opts, L"deleting", sw);
+
+    // songs copied before the interruption aren't in the manifest yet
+    syncplaylists::manifest::Entries_t entries;
+    syncplaylists::manifest::load(usbroot, entries);
+    for (size_t i = 0; i < plan.tocopy.size(); ++i) {
+        if (progress.copied[i])
+            entries.erase(wstring(plan.library.tracks[plan.tocopy[i]].filename));
+    }
+
+    syncplaylists::copier::copyFiles(usbroot, plan.library, tocopy, opts, entries,
+        [&](size_t i) { journal.copied(copyIndexes[i]); });
+    reportPhase(opts, L"copying " + to_wstring(tocopy.size()) + L" files", sw);
+
+    writePlaylists(usbroot, plan.library);
+
+    // the library has every song in the playlists, for pruning the manifest
+    journal.finish();
+    syncplaylists::manifest::save(usbroot, plan.library, entries);
+    reportPhase(opts, L"writing playlists", sw);
+}
+
+// Finishes an interrupted sync.  If a file it needs is gone while the
+// device is still there, trying again won't help, so the journal is
+// discarded and false returned for the caller to sync from scratch.
+static bool resumeSync(const wstring& usbroot, const Options& opts,
+    const syncplaylists::journal::Plan& plan, const syncplaylists::journal::Progress& progress)
+{
+    try {
+        finishSync(usbroot, opts, plan, progress);
+        return true;
+    } catch (const Error& e) {
+        bool gone = e.code() == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) || e.code() == HRESULT_FROM_WIN32(ERROR_PATH_NOT_FOUND);
+        if (!gone || !::PathIsDirectory(usbroot.c_str()))
+            throw;
+        printErr(L"unable to finish the interrupted sync: " + e.message());
+    }
+
+    // the journal was closed as finishSync unwound
+    printErr(L"discarding it and syncing from scratch");
+    syncplaylists::journal::Journal::discard(usbroot);
+    return false;
+}
+
 int wmain(int argc, const wchar_t *argv[])
 {
 
@@ -59,44 +205,202 @@ int wmain(int argc, const wchar_t *argv[])
 
         throwIfFalse(std::setlocale(LC_ALL, "en_US.UTF-8") != nullptr, L"unable to set locale");
 
-        unordered_set<wstring> sync_playlists;
+        Options opts;
+        PlaylistNames_t sync_playlists;
+        vector<wstring> playlistOrder; // as given, for --order playlist
         wstring usbroot;
-      
-        if (argc < 3 || ::wcslen(argv[1]) < 3) {        
-            wstring prodName, prodVer, prodCopyright;
-            if (GetProductVersionInfo(prodName, prodVer, prodCopyright)) {
-                printErr(prodName + L" version " + prodVer + L" " + prodCopyright);
+
+        int argi = 1;
+        for (; argi < argc && ::wcsncmp(argv[argi], L"--", 2) == 0; ++argi) {
+            wstring opt = argv[argi];
+            if (opt == L"--stats") {
+                opts.stats = true;
+            } else if (opt == L"--trust-fs") {
+                opts.trustFs = true;
+            } else if (opt == L"--xml" && argi + 1 < argc) {
+                opts.xmlPath = argv[++argi];
+            } else if (opt == L"--threads" && argi + 1 < argc) {
+                opts.threads = ::wcstoul(argv[++argi], nullptr, 10);
+            } else if (opt == L"--refresh") {
+                opts.refresh = true;
+            } else if (opt == L"--offline") {
+                opts.offline = true;
+            } else if (opt == L"--pipeline") {
+                opts.pipeline = true;
+            } else if (opt == L"--copies" && argi + 1 < argc) {
+                opts.copies = ::wcstoul(argv[++argi], nullptr, 10);
+                throwIfFalse(opts.copies > 0, L"--copies must be at least 1");
+            } else if (opt == L"--copy-backend" && argi + 1 < argc) {
+                wstring backend = argv[++argi];
+                if (backend == L"copyfile") {
+                    opts.copyBackend = CopyBackend::CopyFileApi;
+                } else if (backend == L"copyfile2") {
+                    opts.copyBackend = CopyBackend::CopyFile2;
+                } else if (backend == L"blocks") {
+                    opts.copyBackend = CopyBackend::Blocks;
+                } else {
+                    fail(L"unknown copy backend " + backend);
+                }
+            } else if (opt == L"--block-size" && argi + 1 < argc) {
+                auto mb = ::wcstoul(argv[++argi], nullptr, 10);
+                throwIfFalse(mb >= 1 && mb <= 16, L"--block-size must be from 1 to 16");
+                opts.blockSize = mb * 1024 * 1024;
+            } else if (opt == L"--unbuffered") {
+                opts.unbuffered = true;
+            } else if (opt == L"--verify-extents") {
+                opts.verifyExtents = true;
+            } else if (opt == L"--verify") {
+                opts.verify = true;
+            } else if (opt == L"--content-compare") {
+                opts.contentCompare = true;
+            } else if (opt == L"--rescan") {
+                opts.rescan = true;
+            } else if (opt == L"--order" && argi + 1 < argc) {
+                wstring order = argv[++argi];
+                if (order == L"none") {
+                    opts.copyOrder = CopyOrder::None;
+                } else if (order == L"largest") {
+                    opts.copyOrder = CopyOrder::Largest;
+                } else if (order == L"path") {
+                    opts.copyOrder = CopyOrder::Path;
+                } else if (order == L"playlist") {
+                    opts.copyOrder = CopyOrder::Playlist;
+                } else {
+                    fail(L"unknown copy order " + order);
+                }
+            } else {
+                printErr(L"unknown option " + opt);
+                printUsage(argv[0]);
+                return 1;
             }
-            printErr(L"usage: " + wstring(argv[0]) + L" usbrootdir playlist1 playlist2...");
-            printErr(L"example:");
-            printErr(wstring(argv[0]) + L" e:\\ EDM Rap Rock Pop");
+        }
+      
+        // --verify only needs the device
+        int nargs = opts.verify ? 1 : 2;
+        if (argc - argi < nargs || ::wcslen(argv[argi]) < 3) {        
+            printUsage(argv[0]);
             return 1;
         }        
-        usbroot = argv[1];
-        for (int i = 2; i < argc; ++i) {
-            sync_playlists.insert(argv[i]);
+        usbroot = argv[argi];
+        for (int i = argi + 1; i < argc; ++i) {
+            if (sync_playlists.insert(argv[i]).second)
+                playlistOrder.push_back(argv[i]);
         }
 
-        throwIfFalse(::PathFileExists(usbroot.c_str()), usbroot + L" does not exist");
+        throwIfFalse(::PathFileExists(usbroot.c_str()), [&] { return usbroot + L" does not exist"; });
 
-        throwIfFalse(::PathIsDirectory(usbroot.c_str()), usbroot + L" is not a directory");
+        throwIfFalse(::PathIsDirectory(usbroot.c_str()), [&] { return usbroot + L" is not a directory"; });
 
         if (usbroot.length() > 0 && usbroot[usbroot.length() - 1] != L'\\')
             usbroot.push_back(L'\\');     
 
-        ItunesPlaylists_t initunes;
-        
-        ItunesFiles_t itunesfiles;
-        getPlaylists(sync_playlists, initunes, itunesfiles);
+        if (opts.verify) {
+            syncplaylists::manifest::Entries_t entries;
+            throwIfFalse(syncplaylists::manifest::load(usbroot, entries), [&] { return L"there is no valid manifest on " + usbroot; });
+            Stopwatch vsw;
+            bool ok = syncplaylists::manifest::verify(usbroot, entries, opts.copies);
+            reportPhase(opts, L"verifying", vsw);
+            return ok ? 0 : 1;
+        }
+
+        // A sync of the same playlists that was interrupted is finished
+        // first.  --refresh and --rescan look at everything again instead.
+        {
+            syncplaylists::journal::Plan plan;
+            syncplaylists::journal::Progress progress;
+            if (syncplaylists::journal::Journal::load(usbroot, plan, progress)) {
+                PlaylistNames_t planned(plan.playlists.begin(), plan.playlists.end());
+                if (opts.refresh || opts.rescan) {
+                    printOut(L"discarding the interrupted sync on " + usbroot);
+                    syncplaylists::journal::Journal::discard(usbroot);
+                } else if (planned == sync_playlists) {
+                    printOut(L"resuming the interrupted sync of " + usbroot);
+                    if (resumeSync(usbroot, opts, plan, progress))
+                        return 0;
+                } else {
+                    printOut(L"discarding an interrupted sync of other playlists on " + usbroot);
+                    syncplaylists::journal::Journal::discard(usbroot);
+                }
+            }
+        }
+
+        if (opts.pipeline) {
+            syncplaylists::pipeline::sync(usbroot, sync_playlists, opts);
+            return 0;
+        }
+
+        Stopwatch sw;
+
+        Library library;
+        if (opts.xmlPath.empty()) {
+            getPlaylists(sync_playlists, opts, library);
+            reportPhase(opts, L"reading iTunes playlists", sw);
+        } else {
+            syncplaylists::itunesxml::getPlaylists(opts.xmlPath, opts.threads, sync_playlists, library);
+            reportPhase(opts, L"reading " + opts.xmlPath, sw);
+        }
         
-        DiskFiles_t ondisk;
-        getFilesOnDisk(usbroot, ondisk);
+        // what was copied by earlier runs, and what's on the device if
+        // nothing has changed it since
+        DiskFiles ondisk;
+        syncplaylists::manifest::Entries_t entries;
+        if (!opts.rescan && syncplaylists::manifest::loadIndex(usbroot, entries, ondisk)) {
+            reportPhase(opts, L"reading the index of " + to_wstring(ondisk.size()) + L" files on " + usbroot, sw);
+        } else {
+            getFilesOnDisk(usbroot, ondisk);
+            syncplaylists::manifest::load(usbroot, entries);
+            syncplaylists::manifest::addScanned(ondisk, entries);
+            reportPhase(opts, L"scanning " + to_wstring(ondisk.size()) + L" files on " + usbroot, sw);
+        }
+
+        if (opts.trustFs) {
+            statSourceFiles(library);
+            reportPhase(opts, L"checking " + to_wstring(library.files.size()) + L" source files", sw);
+        }
+
+        vector<TrackId> tocopy;
+        getFilesToCopy(library, ondisk, tocopy);
+        reportPhase(opts, L"comparing " + to_wstring(library.files.size()) + L" files", sw);
+
+        if (opts.contentCompare) {
+            auto nthreads = opts.threads > 0 ? opts.threads : std::thread::hardware_concurrency();
+            syncplaylists::hashcache::addChangedContent(library, entries, nthreads, tocopy);
+            reportPhase(opts, L"comparing contents", sw);
+        }
+
+        syncplaylists::copier::orderCopies(opts, playlistOrder, library, tocopy);
 
-        deleteFiles(usbroot, itunesfiles, ondisk);
+        vector<wstring> todelete;
+        getFilesToDelete(library, ondisk, todelete);
 
-        copyFiles(usbroot, itunesfiles, ondisk);        
+        syncplaylists::manifest::invalidate(usbroot, changingFiles(library, todelete, tocopy));
 
-        writePlaylists(usbroot, initunes);
+        // written to the device before anything on it changes, so an
+        // interrupted sync can be finished by the next run.  There's
+        // nothing to finish if no song is deleted or copied.
+        syncplaylists::journal::Journal journal;
+        if (!todelete.empty() || !tocopy.empty())
+            journal.begin(usbroot, playlistOrder, todelete, tocopy, library);
+
+        deleteFiles(usbroot, todelete, [&](size_t i) { journal.deleted(i); });
+        reportPhase(opts, L"deleting", sw);
+
+        renameToMatch(usbroot, library, ondisk);
+
+        syncplaylists::copier::copyFiles(usbroot, library, tocopy, opts, entries,
+            [&](size_t i) { journal.copied(i); });
+        reportPhase(opts, L"copying " + to_wstring(tocopy.size()) + L" files", sw);
+
+        writePlaylists(usbroot, library);
+
+        // the manifest is saved last, as it records the state of the device
+        journal.finish();
+        syncplaylists::manifest::save(usbroot, library, entries);
+        reportPhase(opts, L"writing playlists", sw);
+
+        if (opts.verifyExtents) {
+            reportExtents(usbroot, library, opts.copyBackend);
+        }
 
     } catch (const std::bad_alloc&) {
         cerr << "memory allocation error" << endl;
@@ -0,0 +1,527 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <windows.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <functional>
+
+#include "common.h"
+#include "util.h"
+#include "binio.h"
+#include "xxhash.h"
+#include "manifest.h"
+
+// The manifest file is
+//
+//   magic, version
+//   the state of the device when it was saved (see DeviceState)
+//   entry count, then for each entry: filename, size, lastWrite, trackId, hashed, hash
+//   playlist count, then the filename of each playlist
+//   checksum of everything before it
+//
+// Version 1 had no device state or playlists and only size, hashed and hash
+// in each entry.  It's still read, but never as an index.
+
+namespace syncplaylists {
+    namespace manifest {
+
+        using namespace std;
+        using namespace common;
+        using namespace util;
+        using namespace binio;
+
+        const wchar_t* const manifest_name = L"syncplaylists.manifest";
+
+        static const unsigned int manifest_magic = 0x4d4e5053; // "SPNM"
+        static const unsigned int manifest_version = 2;
+
+        // unbuffered reads need a sector-aligned buffer and length
+        static const DWORD read_size = 4 * 1024 * 1024;
+
+        // Cheap to read, and changes when files are added to or removed from
+        // the device.  The FAT root directory has no time, so on FAT the free
+        // space is what notices.
+        struct DeviceState {
+            unsigned int serial;
+            unsigned long long rootWrite;
+            unsigned long long freeBytes;
+            unsigned int indexed; // 0 if the manifest isn't an index of the device
+        };
+
+        static bool operator==(const DeviceState& a, const DeviceState& b)
+        {
+            return a.serial == b.serial && a.rootWrite == b.rootWrite && a.freeBytes == b.freeBytes;
+        }
+
+        // the state is at a fixed offset so it can be rewritten in place
+        static const size_t state_offset = 2 * sizeof(unsigned int);
+
+        static bool getDeviceState(const wstring& usbroot, DeviceState& state)
+        {
+            ::memset(&state, 0, sizeof(state));
+
+            wchar_t volume[MAX_PATH];
+            DWORD serial;
+            if (!::GetVolumePathName(usbroot.c_str(), volume, MAX_PATH) ||
+                !::GetVolumeInformation(volume, nullptr, 0, &serial, nullptr, nullptr, nullptr, 0))
+                return false;
+            state.serial = serial;
+
+            ULARGE_INTEGER freeBytes;
+            if (!::GetDiskFreeSpaceEx(usbroot.c_str(), nullptr, nullptr, &freeBytes))
+                return false;
+            state.freeBytes = freeBytes.QuadPart;
+
+            // opening a directory needs backup semantics
+            auto h = ::CreateFile(usbroot.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+            if (h != INVALID_HANDLE_VALUE) {
+                FILETIME ft;
+                if (::GetFileTime(h, nullptr, nullptr, &ft))
+                    state.rootWrite = (static_cast<unsigned long long>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+                ::CloseHandle(h);
+            }
+
+            return true;
+        }
+
+        static void putState(BinWriter& wr, const DeviceState& state)
+        {
+            wr.putU32(state.serial);
+            wr.putU64(state.rootWrite);
+            wr.putU64(state.freeBytes);
+            wr.putU32(state.indexed);
+        }
+
+        // Rewrites the state in an existing manifest without changing its
+        // size, so the directory and the free space are left as they are
+        static void rewriteState(const wstring& usbroot, vector<char>& data, const DeviceState& state)
+        {
+            BinWriter wr;
+            putState(wr, state);
+            ::memcpy(&data[state_offset], &wr.bytes()[0], wr.size());
+
+            auto len = data.size() - sizeof(unsigned long long);
+            auto sum = checksum64(&data[0], len);
+            ::memcpy(&data[len], &sum, sizeof(sum));
+
+            wstring path = usbroot + manifest_name;
+            auto h = ::CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+            throwLastErrorIfFalse(h != INVALID_HANDLE_VALUE, [&] { return L"unable to open " + path; });
+            DWORD nWritten;
+            bool ok = ::WriteFile(h, &data[0], static_cast<DWORD>(data.size()), &nWritten, nullptr) && nWritten == data.size() &&
+                ::FlushFileBuffers(h);
+            ::CloseHandle(h);
+            throwLastErrorIfFalse(ok, [&] { return L"unable to write " + path; });
+        }
+
+        // reads the whole manifest, with the checksum checked and removed
+        static bool readManifest(const wstring& usbroot, vector<char>& data, size_t& len)
+        {
+            if (!readFile(usbroot + manifest_name, data) || data.size() < sizeof(unsigned long long))
+                return false;
+
+            len = data.size() - sizeof(unsigned long long);
+
+            unsigned long long sum;
+            ::memcpy(&sum, &data[len], sizeof(sum));
+            return sum == checksum64(&data[0], len);
+        }
+
+        static bool parse(const char* data, size_t len, Entries_t& entries, DeviceState& state, vector<wstring>& playlists)
+        {
+            ::memset(&state, 0, sizeof(state));
+
+            BinReader rd(data, len);
+
+            unsigned int magic, version, count;
+            if (!rd.getU32(magic) || magic != manifest_magic || !rd.getU32(version) ||
+                (version != 1 && version != manifest_version))
+                return false;
+
+            if (version >= 2 && (!rd.getU32(state.serial) || !rd.getU64(state.rootWrite) ||
+                !rd.getU64(state.freeBytes) || !rd.getU32(state.indexed)))
+                return false;
+
+            if (!rd.getU32(count))
+                return false;
+
+            for (unsigned int i = 0; i < count; ++i) {
+                wstring filename;
+                Entry e;
+                e.lastWrite = 0;
+                e.trackId = 0;
+                unsigned int hashed;
+                if (!rd.getStr(filename) || !rd.getU64(e.size) ||
+                    (version >= 2 && (!rd.getU64(e.lastWrite) || !rd.getI32(e.trackId))) ||
+                    !rd.getU32(hashed) || !rd.getU64(e.hash))
+                    return false;
+                e.hashed = hashed != 0;
+                entries[filename] = e;
+            }
+
+            if (version >= 2) {
+                if (!rd.getU32(count))
+                    return false;
+                for (unsigned int i = 0; i < count; ++i) {
+                    wstring filename;
+                    if (!rd.getStr(filename))
+                        return false;
+                    playlists.push_back(filename);
+                }
+            }
+
+            return rd.atEnd();
+        }
+
+        bool load(const wstring& usbroot, Entries_t& entries)
+        {
+            entries.clear();
+
+            vector<char> data;
+            size_t len;
+            if (!readManifest(usbroot, data, len))
+                return false;
+
+            DeviceState state;
+            vector<wstring> playlists;
+            if (!parse(&data[0], len, entries, state, playlists)) {
+                entries.clear();
+                return false;
+            }
+
+            return true;
+        }
+
+        bool loadIndex(const wstring& usbroot, Entries_t& entries, disk::DiskFiles& ondisk)
+        {
+            entries.clear();
+
+            vector<char> data;
+            size_t len;
+            if (!readManifest(usbroot, data, len))
+                return false;
+
+            DeviceState saved;
+            vector<wstring> playlists;
+            if (!parse(&data[0], len, entries, saved, playlists)) {
+                entries.clear();
+                return false;
+            }
+
+            DeviceState now;
+            if (!saved.indexed || !getDeviceState(usbroot, now) || !(now == saved))
+                return false;
+
+            for (auto const& it : entries) {
+                disk::DiskFile df;
+                df.size = it.second.size;
+                df.lastWrite = it.second.lastWrite;
+                ondisk.add(it.first, df);
+            }
+
+            // only the names of the playlists matter; they're rewritten anyway
+            for (auto const& filename : playlists) {
+                disk::DiskFile df;
+                df.size = 0;
+                df.lastWrite = 0;
+                ondisk.add(filename, df);
+            }
+
+            return true;
+        }
+
+        void addScanned(const disk::DiskFiles& ondisk, Entries_t& entries)
+        {
+            for (auto it = entries.begin(); it != entries.end();) {
+                if (ondisk.find(it->first) == ondisk.end())
+                    it = entries.erase(it);
+                else
+                    ++it;
+            }
+
+            // the entries are keyed by string, so the name is looked up
+            // through one reused buffer
+            wstring filename;
+
+            for (auto const& it : ondisk) {
+                filename.assign(it.first);
+                auto found = entries.find(filename);
+                if (found == entries.end()) {
+                    Entry e;
+                    e.size = it.second.size;
+                    e.lastWrite = it.second.lastWrite;
+                    e.hash = 0;
+                    e.hashed = false;
+                    e.trackId = 0;
+                    entries.emplace(filename, e);
+                    continue;
+                }
+
+                // changed by something other than us, so the hash is no good.
+                // Entries from version 1 have no time and are trusted as before
+                auto& e = found->second;
+                if (e.size != it.second.size || (e.lastWrite != 0 && e.lastWrite != it.second.lastWrite)) {
+                    e.hashed = false;
+                    e.hash = 0;
+                    e.trackId = 0;
+                }
+                e.size = it.second.size;
+                e.lastWrite = it.second.lastWrite;
+            }
+        }
+
+        static void putEntry(BinWriter& wr, wstring_view filename, const Entry& e)
+        {
+            wr.putStr(filename);
+            wr.putU64(e.size);
+            wr.putU64(e.lastWrite);
+            wr.putI32(e.trackId);
+            wr.putU32(e.hashed ? 1 : 0);
+            wr.putU64(e.hash);
+        }
+
+        void invalidate(const wstring& usbroot, const vector<wstring>& changing)
+        {
+            vector<char> data;
+            size_t len;
+            if (!readManifest(usbroot, data, len))
+                return;
+
+            Entries_t entries;
+            DeviceState state;
+            vector<wstring> playlists;
+            if (!parse(&data[0], len, entries, state, playlists))
+                return;
+
+            size_t dropped = 0;
+            for (auto const& filename : changing) {
+                dropped += entries.erase(filename);
+            }
+
+            if (dropped == 0) {
+                // the common case of a sync that only adds songs
+                if (state.indexed) {
+                    state.indexed = 0;
+                    rewriteState(usbroot, data, state);
+                }
+                return;
+            }
+
+            BinWriter wr;
+
+            wr.putU32(manifest_magic);
+            wr.putU32(manifest_version);
+
+            state.indexed = 0;
+            putState(wr, state);
+
+            wr.putU32(static_cast<unsigned int>(entries.size()));
+            for (auto const& it : entries) {
+                putEntry(wr, it.first, it.second);
+            }
+
+            wr.putU32(static_cast<unsigned int>(playlists.size()));
+            for (auto const& filename : playlists) {
+                wr.putStr(filename);
+            }
+
+            auto sum = checksum64(&wr.bytes()[0], wr.size());
+            wr.putU64(sum);
+
+            writeFileAtomic(usbroot + manifest_name, wr.bytes());
+        }
+
+        void save(const wstring& usbroot, const Library& library, Entries_t& entries)
+        {
+            for (auto it = entries.begin(); it != entries.end();) {
+                if (library.files.find(it->first) == library.files.end())
+                    it = entries.erase(it);
+                else
+                    ++it;
+            }
+
+            // An index that's missing a song would have it copied again.
+            // Each entry left is for a different file, so if there are as
+            // many entries as files, every file has one.
+            bool complete = entries.size() == library.files.size();
+            for (auto const& it : entries) {
+                if (it.second.lastWrite == 0) {
+                    complete = false;
+                    break;
+                }
+            }
+
+            BinWriter wr;
+
+            wr.putU32(manifest_magic);
+            wr.putU32(manifest_version);
+
+            // filled in once the file is on the device
+            DeviceState state;
+            ::memset(&state, 0, sizeof(state));
+            putState(wr, state);
+
+            wr.putU32(static_cast<unsigned int>(entries.size()));
+
+            for (auto const& it : entries) {
+                // by the track's name, which the file on the device now has
+                putEntry(wr, library.files.find(it.first)->first, it.second);
+            }
+
+            wr.putU32(static_cast<unsigned int>(library.playlists.size()));
+            for (auto const& it : library.playlists) {
+                wr.putStr(it.first + L".m3u");
+            }
+
+            auto sum = checksum64(&wr.bytes()[0], wr.size());
+            wr.putU64(sum);
+
+            writeFileAtomic(usbroot + manifest_name, wr.bytes());
+
+            // The manifest itself changes the directory and the free space,
+            // so the state is taken after it's written and put in place
+            if (complete && getDeviceState(usbroot, state)) {
+                state.indexed = 1;
+                auto data = wr.bytes();
+                rewriteState(usbroot, data, state);
+            }
+        }
+
+        // returns false if the file can't be read
+        static bool hashFile(const wstring& path, char* buf, unsigned long long& size, unsigned long long& hash)
+        {
+            // without the cache, so the data really comes from the device
+            auto h = ::CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (h == INVALID_HANDLE_VALUE)
+                return false;
+
+            hash::XXH64 hasher;
+            size = 0;
+
+            bool ok = true;
+            for (;;) {
+                DWORD n;
+                if (!::ReadFile(h, buf, read_size, &n, nullptr)) {
+                    ok = false;
+                    break;
+                }
+                if (n == 0)
+                    break;
+                hasher.update(buf, n);
+                size += n;
+            }
+
+            ::CloseHandle(h);
+
+            hash = hasher.digest();
+
+            return ok;
+        }
+
+        bool verify(const wstring& usbroot, const Entries_t& entries, unsigned nthreads)
+        {
+            vector<const Entries_t::value_type*> todo;
+            for (auto const& it : entries) {
+                if (it.second.hashed)
+                    todo.push_back(&it);
+            }
+
+            // copied by a backend that doesn't hash
+            size_t unhashed = entries.size() - todo.size();
+
+            if (todo.empty()) {
+                printErr(L"none of the " + to_wstring(unhashed) + L" files in the manifest on " + usbroot +
+                    L" has a hash to verify, copy them with --copy-backend blocks");
+                return false;
+            }
+
+            if (nthreads < 1)
+                nthreads = 1;
+            if (nthreads > todo.size())
+                nthreads = static_cast<unsigned>(todo.size());
+
+            atomic<size_t> next(0);
+            atomic<size_t> bad(0);
+
+            auto worker = [&]() {
+                auto buf = static_cast<char*>(::VirtualAlloc(nullptr, read_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+                if (!buf) {
+                    printErr(L"unable to allocate a buffer to verify with");
+                    // count what this thread would have checked as failures
+                    for (auto i = next++; i < todo.size(); i = next++) {
+                        ++bad;
+                    }
+                    return;
+                }
+
+                for (auto i = next++; i < todo.size(); i = next++) {
+                    auto path = usbroot + todo[i]->first;
+                    auto const& e = todo[i]->second;
+                    unsigned long long size, hash;
+                    if (!hashFile(path, buf, size, hash)) {
+                        printErr(L"unable to read " + path);
+                        ++bad;
+                    } else if (size != e.size || hash != e.hash) {
+                        printErr(L"corrupt " + path);
+                        ++bad;
+                    }
+                }
+
+                ::VirtualFree(buf, 0, MEM_RELEASE);
+            };
+
+            vector<thread> threads;
+            for (unsigned i = 0; i < nthreads; ++i) {
+                threads.emplace_back(worker);
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+
+            printOut(L"verified " + to_wstring(todo.size() - bad) + L" of " + to_wstring(todo.size()) + L" files on " + usbroot);
+            if (unhashed > 0)
+                printOut(to_wstring(unhashed) + L" files have no hash and weren't checked");
+
+            return bad == 0;
+        }
+
+    } // namespace manifest
+} // namespace syncplaylists
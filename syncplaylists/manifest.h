@@ -0,0 +1,84 @@
+#pragma once
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "common.h"
+#include "disk.h"
+
+namespace syncplaylists {
+    namespace manifest {
+
+        // what was written to a file on the device
+        struct Entry {
+            unsigned long long size;
+            unsigned long long lastWrite; // FILETIME as 100ns ticks, 0 if not known
+            unsigned long long hash; // XXH64 of the contents, if hashed
+            bool hashed; // false if the file was copied by a backend that can't hash
+            long trackId; // the track it was copied from, 0 if not known
+        };
+
+        //                            filename      entry
+        typedef std::unordered_map<std::wstring, Entry, names::NameHash, names::NameEqual> Entries_t;
+
+        // the manifest's filename, in the root of the device
+        extern const wchar_t* const manifest_name;
+
+        // returns false if there is no manifest or it isn't valid
+        bool load(const std::wstring& usbroot, Entries_t& entries);
+
+        // Like load, but if nothing on the device has changed since the
+        // manifest was saved, also fills ondisk from the manifest so the
+        // directory doesn't have to be scanned.  Returns false if it does.
+        bool loadIndex(const std::wstring& usbroot, Entries_t& entries, disk::DiskFiles& ondisk);
+
+        // Brings the entries up to date with a scan of the device: files
+        // that are gone are dropped, files that changed lose their hash, and
+        // files from before there was a manifest get an entry.
+        void addScanned(const disk::DiskFiles& ondisk, Entries_t& entries);
+
+        // Called before changing anything on the device, so the index isn't
+        // trusted if the sync doesn't finish.  The entries of the files in
+        // changing are dropped too, so a sync that's interrupted doesn't
+        // leave the hashes of files it replaced or deleted to fail --verify.
+        void invalidate(const std::wstring& usbroot, const std::vector<std::wstring>& changing);
+
+        // Drops the entries for files that are no longer synced, then saves.
+        // If every song has an entry, the manifest is also an index of the
+        // device, stamped so the next run can tell if anything changed.
+        void save(const std::wstring& usbroot, const common::Library& library, Entries_t& entries);
+
+        // Re-reads each hashed file in the manifest from the device, bypassing
+        // the cache, nthreads at a time, and reports any that don't match and
+        // how many have no hash to check.  Returns false if any is bad or
+        // missing, or if there was nothing to check.
+        bool verify(const std::wstring& usbroot, const Entries_t& entries, unsigned nthreads);
+
+    } // namespace manifest
+} // namespace syncplaylists
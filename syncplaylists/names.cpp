@@ -0,0 +1,174 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include <windows.h>
+#include <emmintrin.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "names.h"
+
+#pragma comment( lib, "normaliz" )
+
+namespace syncplaylists {
+    namespace names {
+
+        using namespace std;
+
+        // long enough for any name FAT or exFAT allows
+        static const size_t short_name = 256;
+
+        // Upper-cases an all-ASCII name eight characters at a time, which is
+        // what nearly every name is.  Returns false if any character isn't
+        // ASCII, leaving out unfinished.
+        static bool foldAscii(const wchar_t* s, size_t len, wchar_t* out)
+        {
+            const __m128i not_ascii = _mm_set1_epi16(static_cast<short>(0xff80));
+            const __m128i before_a = _mm_set1_epi16('a' - 1);
+            const __m128i after_z = _mm_set1_epi16('z' + 1);
+            const __m128i case_bit = _mm_set1_epi16(0x20);
+
+            size_t i = 0;
+            for (; i + 8 <= len; i += 8) {
+                auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, not_ascii), _mm_setzero_si128())) != 0xffff)
+                    return false;
+                auto lower = _mm_and_si128(_mm_cmpgt_epi16(v, before_a), _mm_cmplt_epi16(v, after_z));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_sub_epi16(v, _mm_and_si128(lower, case_bit)));
+            }
+
+            for (; i < len; ++i) {
+                auto c = s[i];
+                if (c >= 0x80)
+                    return false;
+                out[i] = c >= 'a' && c <= 'z' ? static_cast<wchar_t>(c - 0x20) : c;
+            }
+
+            return true;
+        }
+
+        // The invariant upper case of every UTF-16 code unit, asked of
+        // Windows once.  Surrogates and anything it won't map are left alone.
+        static vector<wchar_t> buildUpcaseTable()
+        {
+            vector<wchar_t> table(0x10000);
+            for (size_t c = 0; c < table.size(); ++c) {
+                table[c] = static_cast<wchar_t>(c);
+            }
+
+            vector<wchar_t> upper(table.size());
+
+            auto map = [&](size_t first, size_t end) {
+                auto n = static_cast<int>(end - first);
+                if (::LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, &table[first], n, &upper[first], n,
+                    nullptr, nullptr, 0) == n) {
+                    ::memcpy(&table[first], &upper[first], n * sizeof(wchar_t));
+                }
+            };
+
+            map(1, 0xd800);
+            map(0xe000, 0x10000);
+
+            return table;
+        }
+
+        static const wchar_t* upcaseTable()
+        {
+            static const vector<wchar_t> table = buildUpcaseTable();
+            return &table[0];
+        }
+
+        void fold(wstring_view name, wstring& folded)
+        {
+            folded.resize(name.length());
+            if (name.empty() || foldAscii(name.data(), name.length(), &folded[0]))
+                return;
+
+            // NFC is never more than three times as long
+            auto len = static_cast<int>(name.length());
+            folded.resize(name.length() * 3);
+            auto n = ::NormalizeString(NormalizationC, name.data(), len, &folded[0], static_cast<int>(folded.length()));
+            if (n <= 0) {
+                // not valid UTF-16; compare it as it is
+                folded.assign(name.data(), name.length());
+                n = len;
+            }
+            folded.resize(n);
+
+            auto table = upcaseTable();
+            for (auto& c : folded) {
+                c = table[static_cast<unsigned short>(c)];
+            }
+        }
+
+        static size_t hashChars(const wchar_t* s, size_t len)
+        {
+            // FNV-1a
+            unsigned long long h = 0xcbf29ce484222325ULL;
+            for (size_t i = 0; i < len; ++i) {
+                h ^= static_cast<unsigned short>(s[i]);
+                h *= 0x100000001b3ULL;
+            }
+            return static_cast<size_t>(h);
+        }
+
+        size_t NameHash::operator()(wstring_view name) const
+        {
+            wchar_t buf[short_name];
+            if (name.length() <= short_name && foldAscii(name.data(), name.length(), buf))
+                return hashChars(buf, name.length());
+
+            wstring folded;
+            fold(name, folded);
+            return hashChars(folded.data(), folded.length());
+        }
+
+        bool NameEqual::operator()(wstring_view a, wstring_view b) const
+        {
+            // a name from iTunes usually matches the device exactly
+            if (a == b)
+                return true;
+
+            wchar_t abuf[short_name], bbuf[short_name];
+            if (a.length() <= short_name && b.length() <= short_name &&
+                foldAscii(a.data(), a.length(), abuf) && foldAscii(b.data(), b.length(), bbuf)) {
+                return a.length() == b.length() && ::wmemcmp(abuf, bbuf, a.length()) == 0;
+            }
+
+            wstring afolded, bfolded;
+            fold(a, afolded);
+            fold(b, bfolded);
+            return afolded == bfolded;
+        }
+
+    } // namespace names
+} // namespace syncplaylists
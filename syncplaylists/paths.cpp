@@ -0,0 +1,98 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
+
+#include "flatmap.h"
+#include "arena.h"
+#include "paths.h"
+
+namespace syncplaylists {
+    namespace paths {
+
+        using namespace std;
+
+        const Dir* PathTable::dirOf(wstring_view path)
+        {
+            auto slash = path.rfind(L'\\');
+            if (slash == wstring_view::npos)
+                return nullptr;
+
+            auto dirPath = path.substr(0, slash + 1);
+            if (last && dirPath == lastPath)
+                return last;
+
+            // one folder at a time from the root, adding the ones not seen before
+            const Dir* dir = nullptr;
+            size_t start = 0;
+            while (start < dirPath.length()) {
+                auto end = dirPath.find(L'\\', start) + 1;
+                Child key = { dir, dirPath.substr(start, end - start) };
+
+                auto found = children.find(key);
+                if (found != children.end()) {
+                    dir = found->second;
+                } else {
+                    Dir added = { dir, strings.intern(key.name) };
+                    dirs.push_back(added);
+                    key.name = added.name;
+                    dir = &dirs.back();
+                    children.emplace(key, dir);
+                }
+
+                start = end;
+            }
+
+            lastPath.assign(dirPath);
+            last = dir;
+
+            return dir;
+        }
+
+        void PathTable::append(const Dir* dir, wstring& buf)
+        {
+            if (!dir)
+                return;
+            append(dir->parent, buf);
+            buf += dir->name;
+        }
+
+    } // namespace paths
+} // namespace syncplaylists
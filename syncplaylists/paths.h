@@ -0,0 +1,91 @@
+#pragma once
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+namespace syncplaylists {
+    namespace paths {
+
+        // A folder in a PathTable.  Its name ends with the separator, so a
+        // full path is the names from the root down followed by the leaf.
+        struct Dir {
+            const Dir* parent; // null for a drive or share
+            std::wstring_view name;
+        };
+
+        // Source paths stored as a tree of folders.  Nearly every location
+        // iTunes reports starts with the same long media folder and then an
+        // artist and album folder, so each folder's name is stored once and a
+        // path is a folder plus a leaf name.  Folders are never moved or
+        // changed once added, so they can be read from any thread.
+        class PathTable {
+        public:
+            explicit PathTable(util::StringArena& strings) : strings(strings), last(nullptr) {}
+
+            // the folder of path, which is everything up to the last
+            // separator, with any parts that are new added.  Null if path has
+            // no separator.
+            const Dir* dirOf(std::wstring_view path);
+
+            // appends the path of dir, with the trailing separator, to buf
+            static void append(const Dir* dir, std::wstring& buf);
+
+            // the number of folders
+            size_t size() const { return dirs.size(); }
+
+        private:
+            struct Child {
+                const Dir* parent;
+                std::wstring_view name;
+                bool operator==(const Child& other) const { return parent == other.parent && name == other.name; }
+            };
+
+            struct ChildHash {
+                size_t operator()(const Child& c) const
+                {
+                    return std::hash<std::wstring_view>()(c.name) ^ (reinterpret_cast<size_t>(c.parent) * 31);
+                }
+            };
+
+            util::StringArena& strings;
+            std::deque<Dir> dirs;
+            std::unordered_map<Child, const Dir*, ChildHash> children;
+
+            // tracks usually come an album at a time, so the last folder is
+            // likely to be asked for again
+            std::wstring lastPath;
+            const Dir* last;
+
+            // disallow copying
+            PathTable(PathTable const&) = delete;
+            void operator=(PathTable const&) = delete;
+        };
+
+    } // namespace paths
+} // namespace syncplaylists
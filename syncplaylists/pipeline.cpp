@@ -0,0 +1,226 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <string_view>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "common.h"
+#include "util.h"
+#include "workqueue.h"
+#include "disk.h"
+#include "itunes.h"
+#include "itunesxml.h"
+#include "manifest.h"
+#include "copier.h"
+#include "pipeline.h"
+
+namespace syncplaylists {
+    namespace pipeline {
+
+        using namespace std;
+        using namespace common;
+        using namespace util;
+        using namespace disk;
+
+        // tracks waiting to be copied.  Enough to keep the copier busy
+        // without holding much memory if the device is slow.
+        static const size_t queue_capacity = 1024;
+
+        // thrown by the iTunes callback when the copy stage has stopped
+        // taking tracks, to stop asking iTunes for the rest
+        struct CopyStageStopped {};
+
+        void sync(const wstring& usbroot,
+            const PlaylistNames_t& sync_playlists,
+            const Options& opts)
+        {
+            Stopwatch total;
+
+            // the scan doesn't depend on iTunes at all
+            DiskFiles ondisk;
+            manifest::Entries_t entries;
+            double scanSeconds = 0;
+            auto scan = async(launch::async, [&]() {
+                Stopwatch sw;
+                if (opts.rescan || !manifest::loadIndex(usbroot, entries, ondisk)) {
+                    getFilesOnDisk(usbroot, ondisk);
+                    manifest::load(usbroot, entries);
+                    manifest::addScanned(ondisk, entries);
+                }
+                scanSeconds = sw.seconds();
+            });
+
+            // tracks stay put in the library, so the queue holds pointers
+            BoundedQueue<const Track*> queue(queue_capacity);
+
+            // the copy stage waits for the scan, then hands tracks that need
+            // copying to the copy engine as they arrive
+            size_t ncopied = 0;
+            double copySeconds = 0;
+            double firstCopyAt = -1;
+            exception_ptr copyError;
+
+            thread copyStage([&]() {
+                try {
+                    scan.get();
+
+                    // which files will be replaced isn't known until iTunes
+                    // reports them, so none of the hashes is kept if the
+                    // sync doesn't finish.  entries still has them for save.
+                    vector<wstring> changing;
+                    for (auto const& it : entries) {
+                        changing.push_back(it.first);
+                    }
+                    manifest::invalidate(usbroot, changing);
+
+                    // A copy could replace a duplicate that has the track's
+                    // exact name, and deleting the duplicate at the end would
+                    // then delete the copy, so they go first
+                    vector<wstring> duplicates(ondisk.duplicates().begin(), ondisk.duplicates().end());
+                    deleteFiles(usbroot, duplicates);
+                    ondisk.clearDuplicates();
+
+                    copier::CopyEngine engine(usbroot, opts, entries);
+
+                    // two tracks can have the same filename; the first one wins
+                    util::FlatSet<wstring_view, names::NameHash, names::NameEqual> handled;
+
+                    const Track* track;
+                    while (queue.pop(track)) {
+                        if (!handled.insert(track->filename).second)
+                            continue;
+                        if (!needsCopy(*track, ondisk))
+                            continue;
+                        // The copy goes to the track's exact name.  A device
+                        // file that only matches it ignoring case or
+                        // normalization (NFD from a Mac) would be left beside
+                        // it as a second file, and renaming it at the end
+                        // would collide, so it's renamed first and replaced.
+                        renameToMatch(usbroot, track->filename, ondisk);
+                        if (firstCopyAt < 0)
+                            firstCopyAt = total.seconds();
+                        if (!engine.add(*track))
+                            break;
+                    }
+
+                    engine.finish();
+                    ncopied = engine.copied();
+                    copySeconds = engine.seconds();
+                } catch (...) {
+                    copyError = current_exception();
+                    // stop the producer from blocking on a queue nobody reads
+                    queue.close();
+                }
+            });
+
+            Library library;
+            double readSeconds = 0;
+
+            try {
+                Stopwatch sw;
+                if (opts.xmlPath.empty()) {
+                    itunes::getPlaylists(sync_playlists, opts, library,
+                        [&](const Track& track) {
+                            if (!queue.push(&track))
+                                throw CopyStageStopped();
+                        });
+                } else {
+                    // the XML file is read much faster than files are copied, so
+                    // its tracks are queued once it has been parsed
+                    itunesxml::getPlaylists(opts.xmlPath, opts.threads, sync_playlists, library);
+                    for (auto const& it : library.files) {
+                        if (!queue.push(&library.tracks[it.second]))
+                            break;
+                    }
+                }
+                readSeconds = sw.seconds();
+            } catch (...) {
+                queue.close();
+                copyStage.join();
+                // a failed copy is why reading stopped, and is what to report
+                if (copyError)
+                    rethrow_exception(copyError);
+                throw;
+            }
+
+            queue.close();
+            copyStage.join();
+
+            if (copyError)
+                rethrow_exception(copyError);
+
+            Stopwatch sw;
+
+            // only now is it known which files on the device aren't in any playlist
+            renameToMatch(usbroot, library, ondisk);
+
+            vector<wstring> todelete;
+            getFilesToDelete(library, ondisk, todelete);
+            deleteFiles(usbroot, todelete);
+
+            writePlaylists(usbroot, library);
+
+            manifest::save(usbroot, library, entries);
+
+            auto finishSeconds = sw.seconds();
+
+            if (opts.verifyExtents) {
+                reportExtents(usbroot, library, opts.copyBackend);
+            }
+
+            if (opts.stats) {
+                printOut(L"reading playlists took " + to_wstring(readSeconds) + L" seconds");
+                printOut(L"scanning " + to_wstring(ondisk.size()) + L" files on " + usbroot + L" took " + to_wstring(scanSeconds) + L" seconds");
+                if (ncopied > 0) {
+                    printOut(L"copying " + to_wstring(ncopied) + L" files took " + to_wstring(copySeconds) + L" seconds, starting at " +
+                        to_wstring(firstCopyAt) + L" seconds");
+                }
+                printOut(L"deleting and writing playlists took " + to_wstring(finishSeconds) + L" seconds");
+                printOut(L"total " + to_wstring(total.seconds()) + L" seconds, run one after the other the stages would take " +
+                    to_wstring(readSeconds + scanSeconds + copySeconds + finishSeconds) + L" seconds");
+            }
+        }
+
+    } // namespace pipeline
+} // namespace syncplaylists
@@ -0,0 +1,936 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <exception>
+#include <thread>
+#include <utility>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include "utf8.h"
+#include "plist.h"
+
+// The library export is an Apple plist.  Only the parts we need are looked at:
+//
+// <plist><dict>
+//   <key>Tracks</key>
+//   <dict>
+//     <key>1234</key>
+//     <dict><key>Track ID</key><integer>1234</integer> ... <key>Location</key><string>file://localhost/C:/...</string></dict>
+//     ...
+//   </dict>
+//   <key>Playlists</key>
+//   <array>
+//     <dict><key>Name</key><string>EDM</string> ... <key>Playlist Items</key><array><dict><key>Track ID</key><integer>1234</integer></dict>...</array></dict>
+//     ...
+//   </array>
+// </dict></plist>
+//
+// iTunes always writes Tracks before Playlists, so the file is read once,
+// front to back, through a fixed size buffer.  Only the track table is kept
+// in memory, and only the few fields of it we need.
+//
+// When the whole file is in memory (itunesxml maps it) and more than one
+// thread is allowed, the file isn't streamed.  The
+// Tracks dict, which is nearly all of the file, is indexed by its container
+// tags to find where it ends and where each track ends, and then split into
+// pieces that are parsed on separate threads.  A Tracks dict with comments
+// in it is parsed on one thread, since a comment can hide a tag.
+
+namespace syncplaylists {
+    namespace plist {
+
+        using namespace std;
+
+        // these checks run for every element in the file, so the message is
+        // only put together when one fails
+        static void checkPlist(bool ok, const wchar_t* what, const wstring& path)
+        {
+            if (!ok)
+                throw ParseError(what + (L" in " + path));
+        }
+
+        struct Token {
+            enum Kind { Start, End, Empty, Text };
+            Kind kind;
+            string_view name;   // element name for Start, End and Empty, in the reader's buffer until the next token
+            string text;    // decoded character data for Text
+        };
+
+        // pulls elements and character data out of the file one at a time.
+        // Tokens are found in place in the buffer, which is refilled (and
+        // grown if a single token doesn't fit) when one runs off the end.
+        // A reader can also work directly on a mapped range of the file.
+        class PlistReader {
+        public:
+            PlistReader(FILE* fl, const wstring& path) : fl(fl), path(path), buf(1024 * 1024), cur(nullptr), lim(nullptr) {}
+            PlistReader(const char* b, const char* e, const wstring& path) : fl(nullptr), path(path), cur(b), lim(e) {}
+
+            // returns false at end of file (or of the range).  Without
+            // decode, the text of a Text token is left empty.
+            bool next(Token& tok, bool decode = true);
+
+            // only meaningful for a mapped range
+            const char* position() const { return cur; }
+            void seek(const char* p) { cur = p; }
+            const char* rangeEnd() const { return lim; }
+
+        private:
+            bool refill();
+            void decodeText(const char* b, const char* e, string& out);
+
+            FILE* fl;
+            const wstring& path;
+            vector<char> buf;
+            const char* cur;    // next unread byte in buf
+            const char* lim;    // end of the valid data in buf
+        };
+
+        // keeps the unread bytes and appends more after them.  returns false
+        // if nothing more could be read.
+        bool PlistReader::refill()
+        {
+            if (fl == nullptr)
+                return false;
+
+            size_t keep = cur ? lim - cur : 0;
+
+            if (keep > 0 && cur != &buf[0])
+                ::memmove(&buf[0], cur, keep);
+
+            if (keep == buf.size())
+                buf.resize(buf.size() * 2);
+
+            auto n = ::fread(&buf[keep], 1, buf.size() - keep, fl);
+
+            cur = &buf[0];
+            lim = cur + keep + n;
+
+            return n > 0;
+        }
+
+        static void appendUtf8(unsigned long cp, string& out)
+        {
+            if (cp < 0x80) {
+                out.push_back(static_cast<char>(cp));
+            } else if (cp < 0x800) {
+                out.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+            } else if (cp < 0x10000) {
+                out.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+            } else {
+                out.push_back(static_cast<char>(0xf0 | (cp >> 18)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+            }
+        }
+
+        // resolves the predefined entities and character references
+        void PlistReader::decodeText(const char* b, const char* e, string& out)
+        {
+            out.clear();
+            while (b < e) {
+                auto amp = static_cast<const char*>(::memchr(b, '&', e - b));
+                if (!amp) {
+                    out.append(b, e - b);
+                    break;
+                }
+                out.append(b, amp - b);
+                auto semi = static_cast<const char*>(::memchr(amp, ';', e - amp));
+                checkPlist(semi != nullptr, L"unterminated entity", path);
+                auto ent = amp + 1;
+                auto len = semi - ent;
+                if (len > 1 && ent[0] == '#') {
+                    auto cp = ent[1] == 'x' ? ::strtoul(ent + 2, nullptr, 16) : ::strtoul(ent + 1, nullptr, 10);
+                    appendUtf8(cp, out);
+                } else if (len == 3 && ::strncmp(ent, "amp", 3) == 0) {
+                    out.push_back('&');
+                } else if (len == 2 && ::strncmp(ent, "lt", 2) == 0) {
+                    out.push_back('<');
+                } else if (len == 2 && ::strncmp(ent, "gt", 2) == 0) {
+                    out.push_back('>');
+                } else if (len == 4 && ::strncmp(ent, "quot", 4) == 0) {
+                    out.push_back('"');
+                } else if (len == 4 && ::strncmp(ent, "apos", 4) == 0) {
+                    out.push_back('\'');
+                } else {
+                    checkPlist(false, L"unknown entity", path);
+                }
+                b = semi + 1;
+            }
+        }
+
+        static bool isSpace(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        }
+
+        bool PlistReader::next(Token& tok, bool decode)
+        {
+            for (;;) {
+                // whitespace between elements is not interesting
+                auto p = cur;
+                while (p < lim && isSpace(*p))
+                    ++p;
+
+                if (p == lim) {
+                    cur = p;
+                    if (!refill())
+                        return false;
+                    continue;
+                }
+
+                // between elements the next thing is nearly always a tag
+                auto lt = *p == '<' ? p : static_cast<const char*>(::memchr(p, '<', lim - p));
+
+                if (lt == nullptr) {
+                    checkPlist(refill(), L"unexpected end of file", path);
+                    continue;
+                }
+
+                if (lt != p) {
+                    // keep leading whitespace, it's part of the value
+                    tok.kind = Token::Text;
+                    if (decode)
+                        decodeText(cur, lt, tok.text);
+                    else
+                        tok.text.clear();
+                    cur = lt;
+                    return true;
+                }
+
+                // tags are short, so this is quicker than memchr
+                auto gt = lt + 1;
+                while (gt < lim && *gt != '>')
+                    ++gt;
+
+                if (gt == lim) {
+                    cur = lt;
+                    checkPlist(refill(), L"unterminated tag", path);
+                    continue;
+                }
+
+                auto b = lt + 1;
+
+                if (*b == '?' || *b == '!') {
+                    // a '>' inside a comment doesn't end it
+                    if (gt - b >= 3 && ::strncmp(b, "!--", 3) == 0) {
+                        while (gt - b < 5 || gt[-1] != '-' || gt[-2] != '-') {
+                            auto more = static_cast<const char*>(::memchr(gt + 1, '>', lim - gt - 1));
+                            if (more == nullptr) {
+                                cur = lt;
+                                checkPlist(refill(), L"unterminated comment", path);
+                                b = nullptr;
+                                break;
+                            }
+                            gt = more;
+                        }
+                        if (b == nullptr)
+                            continue;
+                    }
+                    cur = gt + 1;
+                    continue;
+                }
+
+                cur = gt + 1;
+
+                if (*b == '/') {
+                    tok.kind = Token::End;
+                    ++b;
+                } else if (gt[-1] == '/') {
+                    tok.kind = Token::Empty;
+                } else {
+                    tok.kind = Token::Start;
+                }
+
+                auto e = b;
+                while (e < gt && !isSpace(*e) && *e != '/')
+                    ++e;
+
+                tok.name = string_view(b, e - b);
+
+                return true;
+            }
+        }
+
+        // what we keep of each file track until the playlists are read
+        struct XmlTrack {
+            string url;     // still percent-encoded
+            unsigned long long size;
+            unsigned long long lastWrite;
+        };
+
+        static unsigned long long parseNumber(const string& s)
+        {
+            return ::strtoull(s.c_str(), nullptr, 10);
+        }
+
+        // reads n digits at p, returns -1 if they aren't all digits
+        static int parseDigits(const char* p, int n)
+        {
+            int v = 0;
+            for (int i = 0; i < n; ++i) {
+                if (p[i] < '0' || p[i] > '9')
+                    return -1;
+                v = v * 10 + (p[i] - '0');
+            }
+            return v;
+        }
+
+        // "2020-11-28T18:22:01Z" to FILETIME ticks, 0 if it isn't a date
+        static unsigned long long parseDate(const string& s)
+        {
+            auto p = s.c_str();
+            if (s.length() != 20 || p[4] != '-' || p[7] != '-' || p[10] != 'T' ||
+                p[13] != ':' || p[16] != ':' || p[19] != 'Z')
+                return 0;
+
+            int y = parseDigits(p, 4), mo = parseDigits(p + 5, 2), d = parseDigits(p + 8, 2);
+            int h = parseDigits(p + 11, 2), mi = parseDigits(p + 14, 2), sec = parseDigits(p + 17, 2);
+            if (y < 0 || mo < 1 || mo > 12 || d < 1 || h < 0 || mi < 0 || sec < 0)
+                return 0;
+
+            // days since 1970-01-01 in the proleptic Gregorian calendar
+            y -= mo <= 2;
+            long long era = (y >= 0 ? y : y - 399) / 400;
+            long long yoe = y - era * 400;
+            long long doy = (153 * (mo + (mo > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+            long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+            long long days = era * 146097 + doe - 719468;
+
+            long long secs = days * 86400 + h * 3600 + mi * 60 + sec;
+
+            // FILETIME counts 100ns intervals since 1601-01-01
+            const long long epoch_diff = 11644473600LL;
+
+            return static_cast<unsigned long long>((secs + epoch_diff) * 10000000LL);
+        }
+
+        static void utf8ToUnicode(const char* s, size_t len, wstring& out)
+        {
+            out.clear();
+            out.reserve(len);
+            size_t i = 0;
+            while (i < len) {
+                unsigned long cp = static_cast<unsigned char>(s[i]);
+                int extra = cp < 0x80 ? 0 : cp < 0xe0 ? 1 : cp < 0xf0 ? 2 : 3;
+                if (extra)
+                    cp &= 0x3f >> extra;
+                ++i;
+                for (int k = 0; k < extra && i < len; ++k, ++i) {
+                    cp = (cp << 6) | (static_cast<unsigned char>(s[i]) & 0x3f);
+                }
+                if (cp >= 0x10000 && sizeof(wchar_t) == 2) {
+                    cp -= 0x10000;
+                    out.push_back(static_cast<wchar_t>(0xd800 + (cp >> 10)));
+                    out.push_back(static_cast<wchar_t>(0xdc00 + (cp & 0x3ff)));
+                } else {
+                    out.push_back(static_cast<wchar_t>(cp));
+                }
+            }
+        }
+
+        static int hexValue(char c)
+        {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+            return -1;
+        }
+
+        bool urlToPath(string_view url, wstring& path)
+        {
+            const char prefix[] = "file://";
+            const size_t prefix_len = sizeof(prefix) - 1;
+
+            if (url.compare(0, prefix_len, prefix) != 0)
+                return false;
+
+            auto slash = url.find('/', prefix_len);
+            if (slash == string_view::npos)
+                return false;
+
+            string decoded;
+            decoded.reserve(url.length());
+
+            auto host_len = slash - prefix_len;
+            if (host_len > 0 && url.compare(prefix_len, host_len, "localhost") != 0) {
+                decoded = "\\\\";
+                decoded.append(url, prefix_len, host_len);
+                decoded.push_back('\\');
+            }
+
+            for (size_t i = slash + 1; i < url.length(); ++i) {
+                auto c = url[i];
+                if (c == '%' && i + 2 < url.length() && hexValue(url[i + 1]) >= 0 && hexValue(url[i + 2]) >= 0) {
+                    c = static_cast<char>(hexValue(url[i + 1]) * 16 + hexValue(url[i + 2]));
+                    i += 2;
+                } else if (c == '/') {
+                    c = '\\';
+                }
+                decoded.push_back(c);
+            }
+
+            utf8ToUnicode(decoded.c_str(), decoded.length(), path);
+
+            return true;
+        }
+
+        // the element level helpers, shared by the whole-file parser and the
+        // workers that parse pieces of the Tracks dict
+        class PlistTokens {
+        public:
+            PlistTokens(FILE* fl, const wstring& path) : reader(fl, path), path(path), piece(false) {}
+            PlistTokens(const char* b, const char* e, const wstring& path, bool piece = false) : reader(b, e, path), path(path), piece(piece) {}
+
+            // reads one "<key>id</key><dict>...</dict>" entry of the Tracks dict,
+            // skipping tracks that aren't files.  returns false at the end of the
+            // dict, or at the end of the range for a piece of it.
+            bool nextTrack(long& id, XmlTrack& track);
+
+        protected:
+            void advance(bool decode = true);
+            bool nextKey(string& key, bool endOfRangeOk = false);
+            void finishValue(string& text);
+            void skipValue();
+            void skipContainer();
+            void expectStart(const char* name);
+
+            PlistReader reader;
+            Token tok;
+            const wstring& path;
+            bool piece;     // parsing part of the Tracks dict
+            string key;
+            string text;
+        };
+
+        void PlistTokens::advance(bool decode)
+        {
+            checkPlist(reader.next(tok, decode), L"unexpected end of file", path);
+        }
+
+        void PlistTokens::expectStart(const char* name)
+        {
+            advance();
+            checkPlist(tok.kind == Token::Start && tok.name == name, L"malformed plist", path);
+        }
+
+        // reads <key>...</key>, returns false at the </dict> that ends the dict
+        bool PlistTokens::nextKey(string& key, bool endOfRangeOk)
+        {
+            if (!reader.next(tok)) {
+                checkPlist(endOfRangeOk, L"unexpected end of file", path);
+                return false;
+            }
+
+            if (tok.kind == Token::End)
+                return false;
+
+            checkPlist(tok.kind == Token::Start && tok.name == "key", L"expected key", path);
+
+            key.clear();
+            advance();
+            if (tok.kind == Token::Text) {
+                key.swap(tok.text);
+                advance();
+            }
+            checkPlist(tok.kind == Token::End && tok.name == "key", L"unterminated key", path);
+
+            return true;
+        }
+
+        // called with the opening tag of a value in tok, reads what is inside it
+        // up to and including its closing tag.  dicts and arrays are skipped.
+        void PlistTokens::finishValue(string& text)
+        {
+            text.clear();
+
+            if (tok.kind == Token::Empty)
+                return;
+
+            checkPlist(tok.kind == Token::Start, L"expected value", path);
+
+            if (tok.name == "dict" || tok.name == "array") {
+                skipContainer();
+                return;
+            }
+
+            advance();
+            if (tok.kind == Token::Text) {
+                text.swap(tok.text);
+                advance();
+            }
+            checkPlist(tok.kind == Token::End, L"unterminated value", path);
+        }
+
+        // Like finishValue, for values that aren't needed.  Most of the values
+        // in the file are skipped, and they're not decoded or copied.
+        void PlistTokens::skipValue()
+        {
+            if (tok.kind == Token::Empty)
+                return;
+
+            checkPlist(tok.kind == Token::Start, L"expected value", path);
+
+            if (tok.name == "dict" || tok.name == "array") {
+                skipContainer();
+                return;
+            }
+
+            advance(false);
+            if (tok.kind == Token::Text)
+                advance(false);
+            checkPlist(tok.kind == Token::End, L"unterminated value", path);
+        }
+
+        void PlistTokens::skipContainer()
+        {
+            int depth = 1;
+            while (depth > 0) {
+                advance(false);
+                if (tok.kind == Token::Start)
+                    ++depth;
+                else if (tok.kind == Token::End)
+                    --depth;
+            }
+        }
+
+        bool PlistTokens::nextTrack(long& id, XmlTrack& track)
+        {
+            // a piece of the Tracks dict ends right after a track
+            while (nextKey(key, piece)) {
+                advance();
+                if (tok.kind != Token::Start || tok.name != "dict") {
+                    skipValue();
+                    continue;
+                }
+
+                id = -1;
+                track.url.clear();
+                track.size = 0;
+                track.lastWrite = 0;
+                bool isFile = true;
+
+                while (nextKey(key)) {
+                    advance();
+                    if (key == "Track ID") {
+                        finishValue(text);
+                        id = static_cast<long>(parseNumber(text));
+                    } else if (key == "Location") {
+                        finishValue(text);
+                        track.url.swap(text);
+                    } else if (key == "Size") {
+                        finishValue(text);
+                        track.size = parseNumber(text);
+                    } else if (key == "Date Modified") {
+                        finishValue(text);
+                        track.lastWrite = parseDate(text);
+                    } else if (key == "Track Type") {
+                        finishValue(text);
+                        isFile = text == "File";
+                    } else {
+                        skipValue();
+                    }
+                }
+
+                if (isFile && id >= 0 && !track.url.empty())
+                    return true;
+            }
+
+            return false;
+        }
+
+        // Finds the end of the dict whose contents start at p, using only the
+        // container tags: everything else is skipped with memchr, which is
+        // vectorized, instead of being tokenized.  The ends of the entries at
+        // the top level of the dict are collected in splits.
+        //
+        // Returns null if the dict isn't terminated, or if it has a comment,
+        // CDATA section or processing instruction, which could hold tags
+        // that aren't there.  iTunes writes none of them, so the caller just
+        // parses the dict on one thread then.
+        static const char* indexDict(const char* p, const char* e, vector<const char*>& splits)
+        {
+            int depth = 1;
+
+            while ((p = static_cast<const char*>(::memchr(p, '<', e - p))) != nullptr) {
+                auto tag = p++;
+                size_t left = e - p;
+                if (left >= 1 && (*p == '!' || *p == '?')) {
+                    return nullptr;
+                } else if (left >= 5 && ::memcmp(p, "dict>", 5) == 0) {
+                    ++depth;
+                } else if (left >= 6 && ::memcmp(p, "array>", 6) == 0) {
+                    ++depth;
+                } else if (left >= 7 && ::memcmp(p, "/array>", 7) == 0) {
+                    --depth;
+                } else if (left >= 6 && ::memcmp(p, "/dict>", 6) == 0) {
+                    if (--depth == 0)
+                        return tag;
+                    if (depth == 1)
+                        splits.push_back(p + 6);
+                }
+            }
+
+            return nullptr;
+        }
+
+
+        // the index in Selection::tracks of a track that's left out
+        static const size_t no_track = static_cast<size_t>(-1);
+
+        static wstring_view filenameOf(wstring_view path)
+        {
+            auto slash = path.rfind(L'\\');
+            return slash == wstring_view::npos ? path : path.substr(slash + 1);
+        }
+
+        // .m4p in any case.  Only ASCII letters are involved, so there's no
+        // need for the filesystem's case rules.
+        static bool isProtected(wstring_view filename)
+        {
+            const wchar_t ext[] = L".m4p";
+            const size_t len = sizeof(ext) / sizeof(ext[0]) - 1;
+
+            if (filename.length() < len)
+                return false;
+
+            auto p = filename.data() + filename.length() - len;
+            for (size_t i = 0; i < len; ++i) {
+                auto c = p[i];
+                if (c >= L'A' && c <= L'Z')
+                    c += L'a' - L'A';
+                if (c != ext[i])
+                    return false;
+            }
+            return true;
+        }
+
+        class PlistParser : public PlistTokens {
+        public:
+            PlistParser(FILE* fl, const wstring& path,
+                const vector<wstring>& wanted,
+                Selection& selection)
+                : PlistTokens(fl, path), wanted(wanted.begin(), wanted.end()),
+                  selection(selection), threads(1) {}
+
+            // parses a range in memory, splitting the Tracks dict between threads
+            PlistParser(const char* b, const char* e, const wstring& path, unsigned threads,
+                const vector<wstring>& wanted,
+                Selection& selection)
+                : PlistTokens(b, e, path), wanted(wanted.begin(), wanted.end()),
+                  selection(selection), threads(threads) {}
+
+            void parse();
+
+        private:
+            void parseTracks();
+            void parseTracksParallel();
+            void parsePlaylists();
+            void addPlaylist(const wstring& plname, const vector<long>& items);
+            size_t getTrack(long id, const wstring& plname);
+
+            unordered_set<wstring> wanted;
+            unordered_set<wstring> added;   // the first playlist with each name
+            Selection& selection;
+            unsigned threads;
+            unordered_map<long, XmlTrack> tracks;
+            // tracks already added to a playlist, no_track for ones that are skipped
+            unordered_map<long, size_t> seen;
+        };
+
+        void PlistParser::parse()
+        {
+            expectStart("plist");
+            expectStart("dict");
+
+            while (nextKey(key)) {
+                advance();
+                if (key == "Tracks" && tok.kind == Token::Start) {
+                    if (threads > 1)
+                        parseTracksParallel();
+                    else
+                        parseTracks();
+                } else if (key == "Playlists" && tok.kind == Token::Start) {
+                    parsePlaylists();
+                } else {
+                    skipValue();
+                }
+            }
+
+            for (auto const& plname : wanted) {
+                if (added.find(plname) == added.end())
+                    throw ParseError(L"failed to get playist " + plname);
+            }
+        }
+
+        void PlistParser::parseTracks()
+        {
+            long id;
+            XmlTrack track;
+
+            while (nextTrack(id, track)) {
+                tracks[id] = std::move(track);
+            }
+        }
+
+        void PlistParser::parseTracksParallel()
+        {
+            vector<const char*> splits;
+
+            auto begin = reader.position();
+            auto end = indexDict(begin, reader.rangeEnd(), splits);
+
+            // the tokenizer finds whatever is wrong, or skips the comments
+            if (end == nullptr) {
+                parseTracks();
+                return;
+            }
+
+            // give each thread about the same number of tracks
+            vector<const char*> bounds;
+            bounds.push_back(begin);
+            for (unsigned i = 1; i < threads; ++i) {
+                auto n = splits.size() * i / threads;
+                if (n > 0 && splits[n - 1] > bounds.back())
+                    bounds.push_back(splits[n - 1]);
+            }
+            bounds.push_back(end);
+
+            auto npieces = bounds.size() - 1;
+
+            vector<vector<pair<long, XmlTrack> > > pieces(npieces);
+            vector<exception_ptr> errors(npieces);
+            vector<thread> workers;
+
+            for (size_t i = 0; i < npieces; ++i) {
+                workers.emplace_back([&, i]() {
+                    try {
+                        PlistTokens tokens(bounds[i], bounds[i + 1], path, true);
+                        long id;
+                        XmlTrack track;
+                        while (tokens.nextTrack(id, track)) {
+                            pieces[i].emplace_back(id, std::move(track));
+                        }
+                    } catch (...) {
+                        errors[i] = current_exception();
+                    }
+                });
+            }
+
+            for (auto& w : workers) {
+                w.join();
+            }
+
+            for (auto& e : errors) {
+                if (e)
+                    rethrow_exception(e);
+            }
+
+            size_t total = 0;
+            for (auto const& piece : pieces) {
+                total += piece.size();
+            }
+
+            tracks.reserve(total);
+
+            for (auto& piece : pieces) {
+                for (auto& it : piece) {
+                    tracks[it.first] = std::move(it.second);
+                }
+            }
+
+            // carry on after the </dict> that ends Tracks
+            reader.seek(end);
+            advance();
+            checkPlist(tok.kind == Token::End && tok.name == "dict", L"malformed Tracks dict", path);
+        }
+
+        void PlistParser::parsePlaylists()
+        {
+            string name;
+            wstring plname;
+            vector<long> items;
+
+            for (;;) {
+                advance();
+                if (tok.kind == Token::End)
+                    break;
+                if (tok.kind != Token::Start || tok.name != "dict") {
+                    skipValue();
+                    continue;
+                }
+
+                name.clear();
+                items.clear();
+                bool master = false;
+
+                while (nextKey(key)) {
+                    advance();
+                    if (key == "Playlist Items" && tok.kind == Token::Start && tok.name == "array") {
+                        for (;;) {
+                            advance();
+                            if (tok.kind == Token::End)
+                                break;
+                            if (tok.kind != Token::Start || tok.name != "dict") {
+                                skipValue();
+                                continue;
+                            }
+                            while (nextKey(key)) {
+                                advance();
+                                if (key == "Track ID") {
+                                    finishValue(text);
+                                    items.push_back(static_cast<long>(parseNumber(text)));
+                                } else {
+                                    skipValue();
+                                }
+                            }
+                        }
+                    } else {
+                        // <true/> comes back as an Empty token named "true"
+                        if (key == "Master")
+                            master = tok.kind == Token::Empty && tok.name == "true";
+                        if (key == "Name") {
+                            finishValue(text);
+                            name.swap(text);
+                        } else {
+                            skipValue();
+                        }
+                    }
+                }
+
+                // the library itself is not a user playlist
+                if (master)
+                    continue;
+
+                utf8ToUnicode(name.c_str(), name.length(), plname);
+
+                // like the COM interface's ItemByName, the first playlist with a name wins
+                if (wanted.find(plname) != wanted.end() && added.insert(plname).second) {
+                    addPlaylist(plname, items);
+                }
+            }
+        }
+
+        // returns no_track if the track can't be copied
+        size_t PlistParser::getTrack(long id, const wstring& plname)
+        {
+            // tracks that aren't files or have no location aren't kept
+            auto found = tracks.find(id);
+            if (found == tracks.end())
+                return no_track;
+
+            auto& xt = found->second;
+
+            Track track;
+
+            if (!urlToPath(xt.url, track.location)) {
+                selection.skipped.push_back(L"skipping track with unsupported location in playlist " + plname);
+                return no_track;
+            }
+
+            auto filename = filenameOf(track.location);
+
+            if (isProtected(filename)) {
+                selection.skipped.push_back(L"skipping protected file " + wstring(filename));
+                return no_track;
+            }
+
+            track.id = id;
+            track.size = xt.size;
+            track.lastWrite = xt.lastWrite;
+
+            selection.tracks.push_back(std::move(track));
+
+            return selection.tracks.size() - 1;
+        }
+
+        void PlistParser::addPlaylist(const wstring& plname, const vector<long>& items)
+        {
+            selection.playlists.emplace_back();
+            auto& playlist = selection.playlists.back();
+            playlist.name = plname;
+            playlist.tracks.reserve(items.size());
+
+            // items are listed in play order
+            for (size_t i = 0; i < items.size(); ++i) {
+                // tracks in several playlists are only converted once
+                size_t track;
+                auto found = seen.find(items[i]);
+                if (found != seen.end()) {
+                    track = found->second;
+                } else {
+                    track = getTrack(items[i], plname);
+                    seen[items[i]] = track;
+                }
+
+                if (track == no_track)
+                    continue;
+
+                playlist.tracks.push_back(track);
+            }
+        }
+
+        ParseError::ParseError(const wstring& message) : mes(message)
+        {
+            utf8::append(message, full);
+        }
+
+        void parse(FILE* fl, const wstring& name,
+            const vector<wstring>& wanted,
+            Selection& selection)
+        {
+            PlistParser parser(fl, name, wanted, selection);
+            parser.parse();
+        }
+
+        void parse(string_view data, unsigned threads, const wstring& name,
+            const vector<wstring>& wanted,
+            Selection& selection)
+        {
+            PlistParser parser(data.data(), data.data() + data.size(), name, threads == 0 ? 1 : threads,
+                wanted, selection);
+            parser.parse();
+        }
+
+    } // namespace plist
+} // namespace syncplaylists
@@ -0,0 +1,94 @@
+#pragma once
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// The iTunes Library XML parser on its own.  It uses only the standard
+// library, so it builds and is tested on any platform; itunesxml.cpp opens
+// or maps the file and puts what is found into a common::Library.
+
+namespace syncplaylists {
+    namespace plist {
+
+        // what the parser throws for a malformed file, or for a selected
+        // playlist that isn't in it
+        class ParseError : public std::exception {
+        public:
+            explicit ParseError(const std::wstring& message);
+            const char* what() const noexcept override { return full.c_str(); }
+            const std::wstring& message() const { return mes; }
+        private:
+            std::wstring mes;
+            std::string full;   // mes in UTF-8
+        };
+
+        // a file track that is in a selected playlist
+        struct Track {
+            long id;                        // Track ID, the database ID
+            std::wstring location;          // decoded from the file:// URL
+            unsigned long long size;        // 0 if not listed
+            unsigned long long lastWrite;   // FILETIME as 100ns ticks (UTC), 0 if not listed
+        };
+
+        struct Playlist {
+            std::wstring name;
+            std::vector<size_t> tracks;     // indexes into Selection::tracks, in play order
+        };
+
+        // The selected playlists and their tracks.  Tracks that aren't
+        // files, have no location, or are protected are left out.
+        struct Selection {
+            std::vector<Track> tracks;          // each once, in the order first played
+            std::vector<Playlist> playlists;    // in the order they're in the file
+            std::vector<std::wstring> skipped;  // why tracks were left out, to report
+        };
+
+        // Reads the playlists named in wanted and their tracks.  Like the
+        // COM interface's ItemByName, the first playlist with a name wins.
+        // name is the file's, for messages.  Throws ParseError if the file
+        // is malformed or one of the playlists isn't in it.
+
+        // streams the file through a fixed size buffer
+        void parse(FILE* fl, const std::wstring& name,
+            const std::vector<std::wstring>& wanted,
+            Selection& selection);
+
+        // parses the whole file in memory, or mapped.  With more than one
+        // thread, the Tracks dict is split between them.
+        void parse(std::string_view data, unsigned threads, const std::wstring& name,
+            const std::vector<std::wstring>& wanted,
+            Selection& selection);
+
+        // file://localhost/C:/Music/A%20B.m4a -> C:\Music\A B.m4a
+        // file://server/share/A.m4a -> \\server\share\A.m4a
+        // returns false for anything but a file URL
+        bool urlToPath(std::string_view url, std::wstring& path);
+
+    } // namespace plist
+} // namespace syncplaylists
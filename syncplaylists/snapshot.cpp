@@ -0,0 +1,180 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <windows.h>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+
+#include "common.h"
+#include "util.h"
+#include "binio.h"
+#include "snapshot.h"
+
+// The snapshot file is
+//
+//   magic, version
+//   track count, then for each track: id, location, size, last write time
+//   playlist count, then for each playlist: name, fingerprint (count, size,
+//       duration, checksum of the database IDs), song count,
+//       then each song's track, as its index in the tracks, in play order
+//   checksum of everything before it
+
+namespace syncplaylists {
+    namespace snapshot {
+
+        using namespace std;
+        using namespace common;
+        using namespace util;
+        using namespace binio;
+
+        static const unsigned int snapshot_magic = 0x534e5053; // "SPNS"
+        static const unsigned int snapshot_version = 3;
+
+        static wstring snapshotPath()
+        {
+            return getAppDataDir() + L"library.snapshot";
+        }
+
+        bool load(Snapshot& snap)
+        {
+            vector<char> data;
+            if (!readFile(snapshotPath(), data) || data.size() < sizeof(unsigned long long))
+                return false;
+
+            auto len = data.size() - sizeof(unsigned long long);
+
+            unsigned long long sum;
+            ::memcpy(&sum, &data[len], sizeof(sum));
+            if (sum != checksum64(&data[0], len))
+                return false;
+
+            BinReader rd(&data[0], len);
+
+            unsigned int magic, version, ntracks;
+            if (!rd.getU32(magic) || magic != snapshot_magic || !rd.getU32(version) || version != snapshot_version)
+                return false;
+
+            if (!rd.getU32(ntracks))
+                return false;
+
+            // snap is empty, so each track's ID is its index in the file
+            wstring location;
+
+            for (unsigned int i = 0; i < ntracks; ++i) {
+                long id;
+                unsigned long long size, lastWrite;
+                if (!rd.getI32(id) || !rd.getStr(location) || !rd.getU64(size) || !rd.getU64(lastWrite))
+                    return false;
+                auto& track = snap.library.addTrack(id, location);
+                track.size = size;
+                track.lastWrite = lastWrite;
+            }
+
+            unsigned int nplaylists;
+            if (!rd.getU32(nplaylists))
+                return false;
+
+            for (unsigned int i = 0; i < nplaylists; ++i) {
+                wstring name;
+                Fingerprint fp;
+                unsigned int nsongs;
+                if (!rd.getStr(name) || !rd.getI32(fp.count) || !rd.getF64(fp.size) ||
+                    !rd.getI32(fp.duration) || !rd.getU64(fp.ids) || !rd.getU32(nsongs))
+                    return false;
+
+                auto& songs = snap.library.playlists[name];
+                songs.reserve(nsongs);
+
+                for (unsigned int k = 0; k < nsongs; ++k) {
+                    unsigned int index;
+                    if (!rd.getU32(index) || index >= ntracks)
+                        return false;
+                    songs.push_back(index);
+                }
+
+                snap.fingerprints[name] = fp;
+            }
+
+            return rd.atEnd();
+        }
+
+        void save(const Library& library, const Fingerprints_t& fingerprints)
+        {
+            BinWriter wr;
+
+            wr.putU32(snapshot_magic);
+            wr.putU32(snapshot_version);
+
+            // each track once, however many playlists it's in
+            wr.putU32(static_cast<unsigned int>(library.tracks.size()));
+
+            wstring location;
+
+            for (auto const& track : library.tracks) {
+                getLocation(track, location);
+                wr.putI32(track.databaseId);
+                wr.putStr(location);
+                wr.putU64(track.size);
+                wr.putU64(track.lastWrite);
+            }
+
+            wr.putU32(static_cast<unsigned int>(fingerprints.size()));
+
+            for (auto const& it : fingerprints) {
+                auto const& songs = library.playlists.find(it.first)->second;
+                wr.putStr(it.first);
+                wr.putI32(it.second.count);
+                wr.putF64(it.second.size);
+                wr.putI32(it.second.duration);
+                wr.putU64(it.second.ids);
+                wr.putU32(static_cast<unsigned int>(songs.size()));
+                for (auto id : songs) {
+                    wr.putU32(id);
+                }
+            }
+
+            auto sum = checksum64(&wr.bytes()[0], wr.size());
+            wr.putU64(sum);
+
+            try {
+                writeFileAtomic(snapshotPath(), wr.bytes());
+            } catch (const Error& e) {
+                printErr(L"unable to save the playlist snapshot, the next run will ask iTunes for every track: " + e.message());
+            }
+        }
+
+    } // namespace snapshot
+} // namespace syncplaylists
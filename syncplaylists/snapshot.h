@@ -0,0 +1,69 @@
+#pragma once
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "common.h"
+
+namespace syncplaylists {
+    namespace snapshot {
+
+        // what iTunes can tell us about a playlist with two calls per track
+        // instead of several.  If it hasn't changed, the playlist is assumed
+        // not to have changed.  The IDs catch tracks that were reordered or
+        // swapped for others of the same size and length.
+        struct Fingerprint {
+            long count;
+            double size;
+            long duration;
+            unsigned long long ids; // checksum64 of the TrackDatabaseIDs in play order
+
+            bool operator==(const Fingerprint& other) const
+            {
+                return count == other.count && size == other.size && duration == other.duration && ids == other.ids;
+            }
+        };
+
+        //                              playlist      fingerprint
+        typedef std::unordered_map<std::wstring, Fingerprint> Fingerprints_t;
+
+        // the selected playlists as of the last run, kept in the app data directory
+        struct Snapshot {
+            common::Library library;
+            Fingerprints_t fingerprints; // one for each playlist in library
+        };
+
+        // returns false if there is no snapshot or it isn't valid
+        bool load(Snapshot& snap);
+
+        // A snapshot is only a cache, so failing to write it is reported
+        // and doesn't stop the sync.
+        void save(const common::Library& library, const Fingerprints_t& fingerprints);
+    } // namespace snapshot
+} // namespace syncplaylists
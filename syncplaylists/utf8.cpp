@@ -0,0 +1,297 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define UTF8_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#include "utf8.h"
+
+// Filenames and messages are nearly all ASCII, so runs of ASCII are copied
+// with SSE2 or AVX2, whichever the CPU has, and everything else is encoded
+// one character at a time.
+
+#if defined(UTF8_X86) && !defined(_MSC_VER)
+// GCC and clang only emit these instructions in functions that ask for them
+#define UTF8_TARGET(isa) __attribute__((target(isa)))
+#else
+#define UTF8_TARGET(isa)
+#endif
+
+namespace syncplaylists {
+    namespace utf8 {
+
+        using namespace std;
+
+        static const bool wide_is_utf16 = sizeof(wchar_t) == 2;
+
+        static const unsigned long replacement = 0xfffd;
+
+        // copies the leading ASCII of s to out, returning how much there was
+        typedef size_t(*CopyAscii)(const wchar_t* s, size_t len, char* out);
+
+        static size_t copyAsciiScalar(const wchar_t* s, size_t len, char* out)
+        {
+            size_t i = 0;
+            for (; i < len; ++i) {
+                auto c = static_cast<unsigned long>(s[i]);
+                if (c >= 0x80)
+                    break;
+                out[i] = static_cast<char>(c);
+            }
+            return i;
+        }
+
+#ifdef UTF8_X86
+
+        UTF8_TARGET("sse2")
+        static inline bool allZero(__m128i v)
+        {
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) == 0xffff;
+        }
+
+        // 16 characters per step
+        UTF8_TARGET("sse2")
+        static size_t copyAsciiSse2(const wchar_t* s, size_t len, char* out)
+        {
+            size_t i = 0;
+
+            if (wide_is_utf16) {
+                const __m128i not_ascii = _mm_set1_epi16(static_cast<short>(0xff80));
+                for (; i + 16 <= len; i += 16) {
+                    auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+                    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 8));
+                    if (!allZero(_mm_and_si128(_mm_or_si128(a, b), not_ascii)))
+                        break;
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(a, b));
+                }
+            } else {
+                const __m128i not_ascii = _mm_set1_epi32(static_cast<int>(0xffffff80));
+                for (; i + 16 <= len; i += 16) {
+                    auto p = reinterpret_cast<const __m128i*>(s + i);
+                    auto a = _mm_loadu_si128(p);
+                    auto b = _mm_loadu_si128(p + 1);
+                    auto c = _mm_loadu_si128(p + 2);
+                    auto d = _mm_loadu_si128(p + 3);
+                    auto any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+                    if (!allZero(_mm_and_si128(any, not_ascii)))
+                        break;
+                    auto ab = _mm_packs_epi32(a, b);
+                    auto cd = _mm_packs_epi32(c, d);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(ab, cd));
+                }
+            }
+
+            // the rest, and the block that wasn't all ASCII
+            return i + copyAsciiScalar(s + i, len - i, out + i);
+        }
+
+        // 32 characters per step
+        UTF8_TARGET("avx2")
+        static size_t copyAsciiAvx2(const wchar_t* s, size_t len, char* out)
+        {
+            size_t i = 0;
+
+            if (wide_is_utf16) {
+                const __m256i not_ascii = _mm256_set1_epi16(static_cast<short>(0xff80));
+                for (; i + 32 <= len; i += 32) {
+                    auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+                    auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + 16));
+                    if (!_mm256_testz_si256(_mm256_or_si256(a, b), not_ascii))
+                        break;
+                    // packing works within each 128-bit lane, so put the quarters back in order
+                    auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+                }
+            } else {
+                const __m256i not_ascii = _mm256_set1_epi32(static_cast<int>(0xffffff80));
+                for (; i + 32 <= len; i += 32) {
+                    auto p = reinterpret_cast<const __m256i*>(s + i);
+                    auto a = _mm256_loadu_si256(p);
+                    auto b = _mm256_loadu_si256(p + 1);
+                    auto c = _mm256_loadu_si256(p + 2);
+                    auto d = _mm256_loadu_si256(p + 3);
+                    auto any = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+                    if (!_mm256_testz_si256(any, not_ascii))
+                        break;
+                    auto ab = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+                    auto cd = _mm256_permute4x64_epi64(_mm256_packs_epi32(c, d), 0xd8);
+                    auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(ab, cd), 0xd8);
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+                }
+            }
+
+            // the SSE2 code would stall on the upper halves of the YMM registers
+            _mm256_zeroupper();
+
+            return i + copyAsciiSse2(s + i, len - i, out + i);
+        }
+
+        static bool hasAvx2()
+        {
+#ifdef _MSC_VER
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return false;
+            // the OS has to save the YMM registers too
+            __cpuid(info, 1);
+            if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+                return false;
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            return __builtin_cpu_supports("avx2");
+#endif
+        }
+
+        static bool hasSse2()
+        {
+#if defined(_M_X64) || defined(__x86_64__) || defined(_MSC_VER)
+            // part of x64, and the compiler's default for 32-bit Windows
+            return true;
+#else
+            return __builtin_cpu_supports("sse2");
+#endif
+        }
+
+#endif // UTF8_X86
+
+        static CopyAscii chooseCopyAscii()
+        {
+#ifdef UTF8_X86
+            if (hasAvx2())
+                return copyAsciiAvx2;
+            if (hasSse2())
+                return copyAsciiSse2;
+#endif
+            return copyAsciiScalar;
+        }
+
+        static const CopyAscii copyAscii = chooseCopyAscii();
+
+        size_t maxBytes(size_t len)
+        {
+            // a UTF-16 unit is at most three bytes (a pair is four), a UTF-32 one four
+            return len * (wide_is_utf16 ? 3 : 4);
+        }
+
+        // returns how many bytes were written to out, which must have room
+        // for maxBytes(len)
+        static size_t encode(const wchar_t* s, size_t len, char* out)
+        {
+            auto p = out;
+            size_t i = 0;
+
+            while (i < len) {
+                auto c = static_cast<unsigned long>(s[i]);
+
+                if (c < 0x80) {
+                    // a lone one, like the space between two words, isn't
+                    // worth the call
+                    if (i + 1 == len || static_cast<unsigned long>(s[i + 1]) >= 0x80) {
+                        *p++ = static_cast<char>(c);
+                        ++i;
+                        continue;
+                    }
+                    auto n = copyAscii(s + i, len - i, p);
+                    i += n;
+                    p += n;
+                    continue;
+                }
+
+                ++i;
+
+                if (wide_is_utf16) {
+                    c &= 0xffff;
+                    if (c >= 0xd800 && c <= 0xdbff && i < len) {
+                        auto low = static_cast<unsigned long>(s[i]) & 0xffff;
+                        if (low >= 0xdc00 && low <= 0xdfff) {
+                            c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                            ++i;
+                        }
+                    }
+                }
+
+                // a surrogate left over is unpaired
+                if ((c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff)
+                    c = replacement;
+
+                if (c < 0x800) {
+                    *p++ = static_cast<char>(0xc0 | (c >> 6));
+                    *p++ = static_cast<char>(0x80 | (c & 0x3f));
+                } else if (c < 0x10000) {
+                    *p++ = static_cast<char>(0xe0 | (c >> 12));
+                    *p++ = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+                    *p++ = static_cast<char>(0x80 | (c & 0x3f));
+                } else {
+                    *p++ = static_cast<char>(0xf0 | (c >> 18));
+                    *p++ = static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+                    *p++ = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+                    *p++ = static_cast<char>(0x80 | (c & 0x3f));
+                }
+            }
+
+            return p - out;
+        }
+
+        template <typename Out>
+        static void appendTo(wstring_view s, Out& out)
+        {
+            if (s.empty())
+                return;
+
+            auto old = out.size();
+            out.resize(old + maxBytes(s.length()));
+            auto n = encode(s.data(), s.length(), &out[old]);
+            out.resize(old + n);
+        }
+
+        void append(wstring_view s, vector<char>& out)
+        {
+            appendTo(s, out);
+        }
+
+        void append(wstring_view s, string& out)
+        {
+            appendTo(s, out);
+        }
+
+    } // namespace utf8
+} // namespace syncplaylists
@@ -30,14 +30,19 @@ THE SOFTWARE.
 
 #include <windows.h>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
+#include <cstdio>
+#include <exception>
+#include <mutex>
 
 #include <winver.h>
 
 #pragma comment( lib, "version" )
 
 #include "util.h"
+#include "utf8.h"
 
 
 namespace syncplaylists {
@@ -46,82 +51,224 @@ namespace syncplaylists {
 
         using namespace std;       
 
-        const char* unicodeToUtf8(const wchar_t* unicode_str, string& storage)
-        {
+        // the copy workers print too, so whole lines are written under a
+        // lock, which also guards the buffer they're converted in
+        static mutex printMutex;
+        static string printBuffer;
 
-            storage.clear();
+        void printErr(const wstring& ws)
+        {
+            lock_guard<mutex> lock(printMutex);
 
-            auto len = ::WideCharToMultiByte(CP_UTF8, 0, unicode_str, -1, NULL, 0, NULL, NULL);
+            printBuffer.clear();
+            utf8::append(ws, printBuffer);
+            cerr << printBuffer << endl;
+        }
 
-            if (len == 0)
-                return NULL;
+        void printOut(const wstring& ws)
+        {
+            lock_guard<mutex> lock(printMutex);
 
-            // len includes space for null char
-            vector<char> utf8(len);
+            printBuffer.clear();
+            utf8::append(ws, printBuffer);
+            cout << printBuffer << endl;
+        }
 
-            if (::WideCharToMultiByte(CP_UTF8, 0, unicode_str, -1, &utf8[0], len, NULL, NULL) != len) {
-                return nullptr;
+        Error::Error(const wstring& message, long code) : mes(message), hr(code)
+        {
+            utf8::append(mes, full);
+
+            if (hr == 0)
+                return;
+
+            char hex[16];
+            ::sprintf_s(hex, "0x%08lx", static_cast<unsigned long>(hr));
+            full += " (error ";
+            full += hex;
+
+            wchar_t* text = nullptr;
+            auto n = ::FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                nullptr, static_cast<DWORD>(hr), 0, reinterpret_cast<wchar_t*>(&text), 0, nullptr);
+            if (text) {
+                // it ends with a line break
+                while (n > 0 && (text[n - 1] == L'\r' || text[n - 1] == L'\n' || text[n - 1] == L' '))
+                    --n;
+                full += ", ";
+                utf8::append(wstring_view(text, n), full);
+                ::LocalFree(text);
             }
 
-            storage = &utf8[0];
+            full += ")";
+        }
 
-            return &storage[0];
+        void fail(const wstring& mes, long code)
+        {
+            throw Error(mes, code);
         }
 
-        void printErr(const wstring& ws)
+        long lastError()
+        {
+            return HRESULT_FROM_WIN32(::GetLastError());
+        }
+
+        wstring_view getFilename(wstring_view path)
         {
-            string s;
+            auto slash = path.rfind(L'\\');
 
-            if (unicodeToUtf8(ws.c_str(), s)) {
-                cerr << s << endl;
-            } else {
-                cerr << "unable to convert string" << endl;
-            }
+            if (slash == wstring_view::npos)
+                return path;
+
+            return path.substr(slash + 1);
         }
 
-        void printOut(const wstring& ws)
+        wstring_view getExtension(wstring_view filename)
+        {
+            auto dot = filename.rfind(L'.');
+
+            if (dot == wstring_view::npos)
+                return wstring_view();
+
+            return filename.substr(dot + 1);
+        }
+
+        bool equalsIgnoreCase(wstring_view a, wstring_view b)
+        {
+            return ::CompareStringOrdinal(a.data(), static_cast<int>(a.length()),
+                b.data(), static_cast<int>(b.length()), TRUE) == CSTR_EQUAL;
+        }
+
+        bool readFile(const wstring& path, vector<char>& data)
         {
-            string s;
+            data.clear();
+
+            auto hFile = ::CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+            if (hFile == INVALID_HANDLE_VALUE)
+                return false;
 
-            if (unicodeToUtf8(ws.c_str(), s)) {
-                cout << s << endl;
-            } else {
-                cerr << "unable to convert string" << endl;
+            LARGE_INTEGER size;
+            bool ok = ::GetFileSizeEx(hFile, &size) && size.QuadPart < 0x7fffffff;
+
+            if (ok && size.QuadPart > 0) {
+                data.resize(static_cast<size_t>(size.QuadPart));
+                DWORD nRead = 0;
+                ok = ::ReadFile(hFile, &data[0], static_cast<DWORD>(data.size()), &nRead, NULL) && nRead == data.size();
             }
+
+            ::CloseHandle(hFile);
+
+            if (!ok)
+                data.clear();
+
+            return ok;
         }
 
-        void throwIfFalse(bool ok, const wstring& mes)
+        void writeFileAtomic(const wstring& path, const vector<char>& data)
         {
+            wstring tmp = path + L".tmp";
+
+            auto hFile = ::CreateFile(tmp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            throwLastErrorIfFalse(hFile != INVALID_HANDLE_VALUE, [&] { return L"unable to open " + tmp + L" for writing"; });
+
+            DWORD nWritten = 0;
+            bool ok = data.empty() || (::WriteFile(hFile, &data[0], static_cast<DWORD>(data.size()), &nWritten, NULL) && nWritten == data.size());
+
+            // the rename mustn't reach the disk before the data does
+            ok = ok && ::FlushFileBuffers(hFile);
+
+            ::CloseHandle(hFile);
+
             if (!ok) {
-                string s;
-                if (!unicodeToUtf8(mes.c_str(), s))
-                    throw(std::exception("error occured, unable to convert message to utf8"));
-                else
-                    throw(std::exception(s.c_str()));
+                ::DeleteFile(tmp.c_str());
+                fail(L"unable to write " + tmp);
             }
+
+            throwLastErrorIfFalse(::MoveFileEx(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE,
+                [&] { return L"unable to rename " + tmp + L" to " + path; });
         }
 
-        wstring getFilename(const wstring& path)
+        wstring getAppDataDir()
         {
-            if (path.length() < 1)
-                return L"";
+            WCHAR buf[MAX_PATH + 1];
 
-            auto p = ::wcsrchr(path.c_str(), L'\\');
+            auto len = ::GetEnvironmentVariable(L"LOCALAPPDATA", buf, MAX_PATH);
 
-            if (!p)
-                return path;
+            if (len > 0 && len < MAX_PATH) {
+                wstring dir = wstring(buf) + L"\\syncplaylists\\";
+                if (::CreateDirectory(dir.c_str(), NULL) || ::GetLastError() == ERROR_ALREADY_EXISTS)
+                    return dir;
+            }
+
+            len = ::GetModuleFileName(NULL, buf, MAX_PATH);
+            throwIfFalse(len > 0 && len < MAX_PATH, L"unable to get the path of the executable");
+
+            wstring exe(buf);
+
+            return exe.substr(0, exe.length() - getFilename(exe).length());
+        }
+
+        unsigned long long checksum64(const void* data, size_t len)
+        {
+            auto p = static_cast<const unsigned char*>(data);
+            unsigned long long h = 14695981039346656037ULL;
+            for (size_t i = 0; i < len; ++i) {
+                h ^= p[i];
+                h *= 1099511628211ULL;
+            }
+            return h;
+        }
 
-            return p + 1;
+        double Stopwatch::seconds() const
+        {
+            LARGE_INTEGER now, freq;
+            ::QueryPerformanceCounter(&now);
+            ::QueryPerformanceFrequency(&freq);
+            return static_cast<double>(now.QuadPart - start.QuadPart) / freq.QuadPart;
         }
 
-        wstring getExtension(const wstring& filename)
+        bool MappedFile::open(const wstring& path)
         {
-            auto pdot = ::wcsrchr(filename.c_str(), L'.');
+            close();
+
+            file = ::CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+            if (file == INVALID_HANDLE_VALUE)
+                return false;
+
+            LARGE_INTEGER size;
+            if (!::GetFileSizeEx(file, &size) || size.QuadPart == 0 ||
+                static_cast<unsigned long long>(size.QuadPart) > static_cast<size_t>(-1)) {
+                close();
+                return false;
+            }
+
+            mapping = ::CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping == nullptr) {
+                close();
+                return false;
+            }
+
+            view = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (view == nullptr) {
+                close();
+                return false;
+            }
 
-            if (!pdot)
-                return L"";
+            len = static_cast<size_t>(size.QuadPart);
 
-            return pdot + 1;
+            return true;
+        }
+
+        void MappedFile::close()
+        {
+            if (view)
+                ::UnmapViewOfFile(view);
+            if (mapping)
+                ::CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE)
+                ::CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+            mapping = nullptr;
+            view = nullptr;
+            len = 0;
         }
 
         bool GetProductVersionInfo(wstring& strProductName, wstring& strProductVersion,
@@ -33,17 +33,129 @@ namespace syncplaylists {
 
     namespace util {     
 
-        const char* unicodeToUtf8(const wchar_t* unicode_str, std::string& storage);
-
         void printErr(const std::wstring& ws);
 
         void printOut(const std::wstring& ws);
 
-        void throwIfFalse(bool ok, const std::wstring& mes);
-
-        std::wstring getFilename(const std::wstring& path);
-
-        std::wstring getExtension(const std::wstring& filename);
+        // What everything here throws when it fails.  code is the HRESULT of
+        // the call that failed, with Win32 errors as HRESULT_FROM_WIN32, or 0
+        // if no call failed.
+        class Error : public std::exception {
+        public:
+            Error(const std::wstring& message, long code);
+            const char* what() const noexcept override { return full.c_str(); }
+            const std::wstring& message() const { return mes; }
+            long code() const { return hr; }
+        private:
+            std::wstring mes;
+            std::string full; // mes in UTF-8, with the code if there is one
+            long hr;
+        };
+
+        [[noreturn]] void fail(const std::wstring& mes, long code = 0);
+
+        // GetLastError as an HRESULT
+        long lastError();
+
+        // The message is only built if something failed, so where it isn't a
+        // literal, pass a lambda that returns it, not a string built up front.
+
+        inline void throwIfFalse(bool ok, const wchar_t* mes)
+        {
+            if (!ok)
+                fail(mes);
+        }
+
+        template <typename Message>
+        inline void throwIfFalse(bool ok, const Message& message)
+        {
+            if (!ok)
+                fail(message());
+        }
+
+        // after a Win32 call, with the code from GetLastError
+        inline void throwLastErrorIfFalse(bool ok, const wchar_t* mes)
+        {
+            if (!ok)
+                fail(mes, lastError());
+        }
+
+        template <typename Message>
+        inline void throwLastErrorIfFalse(bool ok, const Message& message)
+        {
+            if (!ok) {
+                // before building the message can change it
+                auto code = lastError();
+                fail(message(), code);
+            }
+        }
+
+        // after a COM call.  Anything but S_OK fails, as iTunes returns
+        // S_FALSE for things it doesn't have.
+        inline void throwIfNotOk(long hr, const wchar_t* mes)
+        {
+            if (hr != 0)
+                fail(mes, hr);
+        }
+
+        template <typename Message>
+        inline void throwIfNotOk(long hr, const Message& message)
+        {
+            if (hr != 0)
+                fail(message(), hr);
+        }
+
+        // both return part of their argument
+        std::wstring_view getFilename(std::wstring_view path);
+
+        std::wstring_view getExtension(std::wstring_view filename);
+
+        // ordinal, like the filesystem, without locale rules
+        bool equalsIgnoreCase(std::wstring_view a, std::wstring_view b);
+
+        // returns false if the file doesn't exist or can't be read
+        bool readFile(const std::wstring& path, std::vector<char>& data);
+
+        // writes to a temporary file first and then renames it over path, so
+        // path always has either the old or the new contents
+        void writeFileAtomic(const std::wstring& path, const std::vector<char>& data);
+
+        // %LOCALAPPDATA%\syncplaylists\ (created if needed), or the directory
+        // of the executable if there is no LOCALAPPDATA
+        std::wstring getAppDataDir();
+
+        // FNV-1a, for checksums of our own files
+        unsigned long long checksum64(const void* data, size_t len);
+
+        // wall-clock timer used for --stats
+        class Stopwatch {
+        public:
+            Stopwatch() { reset(); }
+            void reset() { ::QueryPerformanceCounter(&start); }
+            double seconds() const;
+        private:
+            LARGE_INTEGER start;
+        };
+
+        // read-only view of a whole file
+        class MappedFile {
+        public:
+            MappedFile() : file(INVALID_HANDLE_VALUE), mapping(nullptr), view(nullptr), len(0) {}
+            ~MappedFile() { close(); }
+            // returns false if the file can't be opened or mapped (or is empty)
+            bool open(const std::wstring& path);
+            void close();
+            const char* data() const { return static_cast<const char*>(view); }
+            size_t size() const { return len; }
+            // disallow copying
+            MappedFile(MappedFile const&) = delete;
+            void operator=(MappedFile const&) = delete;
+        private:
+            HANDLE file;
+            HANDLE mapping;
+            const void* view;
+            size_t len;
+        };
 
         bool GetProductVersionInfo(std::wstring& strProductName, std::wstring& strProductVersion,
                                    std::wstring& strLegalCopyright, HMODULE hMod = nullptr);
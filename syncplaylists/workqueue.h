@@ -0,0 +1,86 @@
+#pragma once
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+namespace syncplaylists {
+    namespace util {
+
+        // fixed-capacity queue between threads.  push blocks while the queue
+        // is full and pop blocks while it's empty.  After close, push
+        // discards and pop drains what's left and then returns false.
+        template <typename T>
+        class BoundedQueue {
+        public:
+            explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+            // returns false if the queue was closed
+            bool push(T item)
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+                if (closed)
+                    return false;
+                items.push_back(std::move(item));
+                notEmpty.notify_one();
+                return true;
+            }
+
+            // returns false once the queue is closed and empty
+            bool pop(T& item)
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+                if (items.empty())
+                    return false;
+                item = std::move(items.front());
+                items.pop_front();
+                notFull.notify_one();
+                return true;
+            }
+
+            void close()
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                closed = true;
+                notFull.notify_all();
+                notEmpty.notify_all();
+            }
+
+        private:
+            std::mutex mtx;
+            std::condition_variable notFull;
+            std::condition_variable notEmpty;
+            std::deque<T> items;
+            size_t capacity;
+            bool closed;
+        };
+
+    } // namespace util
+} // namespace syncplaylists
@@ -0,0 +1,181 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "xxhash.h"
+
+namespace syncplaylists {
+    namespace hash {
+
+        static const unsigned long long prime1 = 0x9E3779B185EBCA87ULL;
+        static const unsigned long long prime2 = 0xC2B2AE3D27D4EB4FULL;
+        static const unsigned long long prime3 = 0x165667B19E3779F9ULL;
+        static const unsigned long long prime4 = 0x85EBCA77C2B2AE63ULL;
+        static const unsigned long long prime5 = 0x27D4EB2F165667C5ULL;
+
+        static inline unsigned long long rotl(unsigned long long x, int r)
+        {
+            return (x << r) | (x >> (64 - r));
+        }
+
+        // unaligned little-endian loads.  memcpy compiles to a plain load.
+        static inline unsigned long long read64(const unsigned char* p)
+        {
+            unsigned long long v;
+            ::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        static inline unsigned long long read32(const unsigned char* p)
+        {
+            unsigned int v;
+            ::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        static inline unsigned long long round(unsigned long long acc, unsigned long long input)
+        {
+            acc += input * prime2;
+            acc = rotl(acc, 31);
+            return acc * prime1;
+        }
+
+        static inline unsigned long long mergeRound(unsigned long long h, unsigned long long acc)
+        {
+            h ^= round(0, acc);
+            return h * prime1 + prime4;
+        }
+
+        XXH64::XXH64(unsigned long long seed) : npending(0), total(0), seed(seed)
+        {
+            acc[0] = seed + prime1 + prime2;
+            acc[1] = seed + prime2;
+            acc[2] = seed;
+            acc[3] = seed - prime1;
+        }
+
+        void XXH64::update(const void* data, size_t len)
+        {
+            auto p = static_cast<const unsigned char*>(data);
+            auto end = p + len;
+
+            total += len;
+
+            // finish a stripe left over from the last call
+            if (npending > 0) {
+                auto n = sizeof(pending) - npending;
+                if (len < n) {
+                    ::memcpy(pending + npending, p, len);
+                    npending += len;
+                    return;
+                }
+                ::memcpy(pending + npending, p, n);
+                p += n;
+                for (int i = 0; i < 4; ++i) {
+                    acc[i] = round(acc[i], read64(pending + i * 8));
+                }
+                npending = 0;
+            }
+
+            // the four lanes are independent, so the CPU runs them in parallel
+            if (end - p >= 32) {
+                auto v1 = acc[0], v2 = acc[1], v3 = acc[2], v4 = acc[3];
+                auto limit = end - 32;
+                do {
+                    v1 = round(v1, read64(p));
+                    v2 = round(v2, read64(p + 8));
+                    v3 = round(v3, read64(p + 16));
+                    v4 = round(v4, read64(p + 24));
+                    p += 32;
+                } while (p <= limit);
+                acc[0] = v1; acc[1] = v2; acc[2] = v3; acc[3] = v4;
+            }
+
+            if (p < end) {
+                npending = end - p;
+                ::memcpy(pending, p, npending);
+            }
+        }
+
+        unsigned long long XXH64::digest() const
+        {
+            unsigned long long h;
+
+            if (total >= 32) {
+                h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+                for (int i = 0; i < 4; ++i) {
+                    h = mergeRound(h, acc[i]);
+                }
+            } else {
+                h = seed + prime5;
+            }
+
+            h += total;
+
+            auto p = pending;
+            auto end = pending + npending;
+
+            while (end - p >= 8) {
+                h ^= round(0, read64(p));
+                h = rotl(h, 27) * prime1 + prime4;
+                p += 8;
+            }
+
+            if (end - p >= 4) {
+                h ^= read32(p) * prime1;
+                h = rotl(h, 23) * prime2 + prime3;
+                p += 4;
+            }
+
+            while (p < end) {
+                h ^= *p * prime5;
+                h = rotl(h, 11) * prime1;
+                ++p;
+            }
+
+            h ^= h >> 33;
+            h *= prime2;
+            h ^= h >> 29;
+            h *= prime3;
+            h ^= h >> 32;
+
+            return h;
+        }
+
+        unsigned long long xxh64(const void* data, size_t len, unsigned long long seed)
+        {
+            XXH64 h(seed);
+            h.update(data, len);
+            return h.digest();
+        }
+
+    } // namespace hash
+} // namespace syncplaylists
@@ -0,0 +1,305 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Checks the plist parser against the exports in fixtures/.  Run with the
+// fixtures directory as the argument.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <memory>
+
+#include "plist.h"
+
+using namespace std;
+using namespace syncplaylists;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++failures; \
+        } \
+    } while (0)
+
+static string fixtures;
+
+static string readFixture(const char* name)
+{
+    ifstream in(fixtures + "/" + name, ios::binary);
+    if (!in) {
+        fprintf(stderr, "can't open fixture %s\n", name);
+        ++failures;
+        return string();
+    }
+    ostringstream s;
+    s << in.rdbuf();
+    return s.str();
+}
+
+// the three ways the file can be parsed
+enum class Mode { Stream, Memory, Threads };
+
+static void parse(const string& data, Mode mode, const vector<wstring>& wanted, plist::Selection& selection)
+{
+    const wstring name = L"fixture.xml";
+
+    if (mode == Mode::Stream) {
+        unique_ptr<FILE, int (*)(FILE*)> fl(tmpfile(), fclose);
+        fwrite(data.data(), 1, data.size(), fl.get());
+        rewind(fl.get());
+        plist::parse(fl.get(), name, wanted, selection);
+    } else {
+        plist::parse(data, mode == Mode::Threads ? 4 : 1, name, wanted, selection);
+    }
+}
+
+// returns the message, or an empty string if nothing was thrown
+static wstring parseError(const string& data, Mode mode, const vector<wstring>& wanted)
+{
+    try {
+        plist::Selection selection;
+        parse(data, mode, wanted, selection);
+    } catch (const plist::ParseError& e) {
+        return e.message();
+    }
+    return wstring();
+}
+
+static bool same(const plist::Selection& a, const plist::Selection& b)
+{
+    if (a.tracks.size() != b.tracks.size() || a.playlists.size() != b.playlists.size() || a.skipped != b.skipped)
+        return false;
+    for (size_t i = 0; i < a.tracks.size(); ++i) {
+        auto const& x = a.tracks[i];
+        auto const& y = b.tracks[i];
+        if (x.id != y.id || x.location != y.location || x.size != y.size || x.lastWrite != y.lastWrite)
+            return false;
+    }
+    for (size_t i = 0; i < a.playlists.size(); ++i) {
+        if (a.playlists[i].name != b.playlists[i].name || a.playlists[i].tracks != b.playlists[i].tracks)
+            return false;
+    }
+    return true;
+}
+
+static const wchar_t* const drive = L"Drive <Mix>";
+static const wchar_t* const cafe = L"Caf\u00e9";
+
+static void testLibrary(Mode mode)
+{
+    auto data = readFixture("library.xml");
+
+    plist::Selection selection;
+    parse(data, mode, { cafe, drive, L"Empty" }, selection);
+
+    // in file order, and the second "Drive <Mix>" is ignored
+    CHECK(selection.playlists.size() == 3);
+    if (selection.playlists.size() != 3)
+        return;
+    CHECK(selection.playlists[0].name == drive);
+    CHECK(selection.playlists[1].name == L"Empty");
+    CHECK(selection.playlists[2].name == cafe);
+
+    // tracks in the order they're first played
+    CHECK(selection.tracks.size() == 3);
+    if (selection.tracks.size() != 3)
+        return;
+
+    auto const& server = selection.tracks[0];
+    CHECK(server.id == 103);
+    CHECK(server.location == L"\\\\nas\\music\\Artist\\Song.flac");
+    CHECK(server.size == 1234);
+    CHECK(server.lastWrite == 0);
+
+    auto const& rock = selection.tracks[1];
+    CHECK(rock.id == 101);
+    CHECK(rock.location == L"C:\\Users\\me\\Music\\iTunes\\iTunes Media\\Music\\AC DC\\Rock & Roll.m4a");
+    CHECK(rock.size == 5242880);
+    CHECK(rock.lastWrite == 132510613210000000ULL);
+
+    auto const& song = selection.tracks[2];
+    CHECK(song.id == 102);
+    CHECK(song.location == L"C:\\Music\\Caf\u00e9 \U0001F3B5.mp3");
+    CHECK(song.size == 3000000);
+    CHECK(song.lastWrite == 131908718450000000ULL);
+
+    // the stream, the track with no location, the unknown ID, the
+    // protected file and the ftp URL are left out.  Only the last two are
+    // worth telling the user about.
+    CHECK((selection.playlists[0].tracks == vector<size_t>{ 0, 1 }));
+    CHECK(selection.playlists[1].tracks.empty());
+    CHECK((selection.playlists[2].tracks == vector<size_t>{ 2, 1 }));
+
+    CHECK(selection.skipped.size() == 2);
+    if (selection.skipped.size() == 2) {
+        CHECK(selection.skipped[0] == L"skipping protected file Protected.M4P");
+        CHECK(selection.skipped[1] == L"skipping track with unsupported location in playlist Drive <Mix>");
+    }
+}
+
+static void testMissingPlaylist(Mode mode)
+{
+    auto data = readFixture("library.xml");
+
+    CHECK(parseError(data, mode, { drive, L"Nope" }) == L"failed to get playist Nope");
+
+    // the library itself isn't a playlist that can be synced
+    CHECK(parseError(data, mode, { L"Library" }) == L"failed to get playist Library");
+
+    // names are matched exactly
+    CHECK(parseError(data, mode, { L"drive <mix>" }) == L"failed to get playist drive <mix>");
+
+    plist::Selection selection;
+    parse(data, mode, {}, selection);
+    CHECK(selection.playlists.empty());
+    CHECK(selection.tracks.empty());
+}
+
+static void testMalformed(Mode mode)
+{
+    CHECK(parseError(readFixture("unknown-entity.xml"), mode, {}) == L"unknown entity in fixture.xml");
+    CHECK(parseError(readFixture("mismatched.xml"), mode, { L"Drive" }) == L"unterminated key in fixture.xml");
+    CHECK(parseError(readFixture("not-a-plist.xml"), mode, {}) == L"malformed plist in fixture.xml");
+    CHECK(parseError(string(), mode, {}) == L"unexpected end of file in fixture.xml");
+}
+
+// Comments in the Tracks dict that look like container tags mustn't move
+// where it's split or where it ends.
+static void testComments(Mode mode)
+{
+    plist::Selection selection;
+    parse(readFixture("commented.xml"), mode, { L"Mix" }, selection);
+
+    CHECK(selection.playlists.size() == 1);
+    CHECK(selection.tracks.size() == 4);
+    if (selection.playlists.size() != 1 || selection.tracks.size() != 4)
+        return;
+
+    CHECK((selection.playlists[0].tracks == vector<size_t>{ 0, 1, 2, 3 }));
+    CHECK(selection.tracks[0].id == 204 && selection.tracks[0].location == L"C:\\Music\\Four.mp3");
+    CHECK(selection.tracks[1].id == 201 && selection.tracks[1].size == 100);
+    CHECK(selection.tracks[2].id == 203 && selection.tracks[2].size == 300);
+    CHECK(selection.tracks[3].id == 202 && selection.tracks[3].location == L"C:\\Music\\Two.mp3");
+}
+
+// Cuts the file off at every byte.  Each piece must be rejected, unless it
+// has the whole top level dict, and then it must give the full result.
+static void testTruncated(Mode mode)
+{
+    auto data = readFixture("library.xml");
+    vector<wstring> wanted = { cafe, drive };
+
+    plist::Selection full;
+    parse(data, mode, wanted, full);
+
+    auto complete = data.rfind("</dict>") + 7;
+
+    for (size_t n = 0; n < data.size(); ++n) {
+        plist::Selection selection;
+        bool threw = false;
+        try {
+            parse(data.substr(0, n), mode, wanted, selection);
+        } catch (const plist::ParseError&) {
+            threw = true;
+        }
+        if (n < complete) {
+            CHECK(threw);
+        } else {
+            CHECK(!threw && same(selection, full));
+        }
+    }
+}
+
+static void testModesAgree()
+{
+    auto data = readFixture("library.xml");
+    vector<wstring> wanted = { cafe, drive, L"Empty" };
+
+    plist::Selection stream, memory, threads;
+    parse(data, Mode::Stream, wanted, stream);
+    parse(data, Mode::Memory, wanted, memory);
+    parse(data, Mode::Threads, wanted, threads);
+
+    CHECK(same(stream, memory));
+    CHECK(same(stream, threads));
+}
+
+static void testUrlToPath()
+{
+    wstring path;
+
+    CHECK(plist::urlToPath("file://localhost/C:/Music/A%20B.m4a", path) && path == L"C:\\Music\\A B.m4a");
+    CHECK(plist::urlToPath("file:///C:/Music/A.m4a", path) && path == L"C:\\Music\\A.m4a");
+    CHECK(plist::urlToPath("file://server/share/A.m4a", path) && path == L"\\\\server\\share\\A.m4a");
+
+    // percent-encoded UTF-8, a literal percent, and a bad escape kept as it is
+    CHECK(plist::urlToPath("file://localhost/C:/%E6%97%A5%E6%9C%AC/100%25%20%F0%9F%8E%B5.mp3", path) &&
+        path == L"C:\\\u65e5\u672c\\100% \U0001F3B5.mp3");
+    CHECK(plist::urlToPath("file://localhost/C:/a%G1.mp3", path) && path == L"C:\\a%G1.mp3");
+
+    CHECK(!plist::urlToPath("http://localhost/C:/a.mp3", path));
+    CHECK(!plist::urlToPath("file://localhost", path));
+    CHECK(!plist::urlToPath("", path));
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: plist_tests fixtures-directory\n");
+        return 2;
+    }
+
+    fixtures = argv[1];
+
+    testUrlToPath();
+    testModesAgree();
+
+    for (auto mode : { Mode::Stream, Mode::Memory, Mode::Threads }) {
+        testLibrary(mode);
+        testMissingPlaylist(mode);
+        testMalformed(mode);
+        testComments(mode);
+        testTruncated(mode);
+    }
+
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    else
+        printf("all plist checks passed\n");
+
+    return failures ? 1 : 0;
+}
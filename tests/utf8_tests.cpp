@@ -0,0 +1,198 @@
+/*
+syncplaylists : Copies music files from specified iTunes playlists to specfied
+                directory and writes .m3u playlist files.  Deletes all music
+                and .m3u files that are not specified in the playlists.
+
+Copyright (C) 2020 Bailey Brown (github.com/bailey27/syncplaylists)
+
+cppcryptfs is based on the design of gocryptfs (github.com/rfjakob/gocryptfs)
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Checks utf8::append against a plain encoder, and that it fits in the
+// room maxBytes promises, which renderPlaylist relies on to fill a
+// playlist's buffer without reallocating.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+
+#include "utf8.h"
+
+using namespace std;
+using namespace syncplaylists;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++failures; \
+        } \
+    } while (0)
+
+static const bool wide_is_utf16 = sizeof(wchar_t) == 2;
+
+// one character at a time, the obvious way
+static string reference(wstring_view s)
+{
+    string out;
+    for (size_t i = 0; i < s.length(); ++i) {
+        auto c = static_cast<unsigned long>(s[i]);
+        if (wide_is_utf16) {
+            c &= 0xffff;
+            if (c >= 0xd800 && c <= 0xdbff && i + 1 < s.length()) {
+                auto low = static_cast<unsigned long>(s[i + 1]) & 0xffff;
+                if (low >= 0xdc00 && low <= 0xdfff) {
+                    c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                    ++i;
+                }
+            }
+        }
+        if ((c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff)
+            c = 0xfffd;
+
+        if (c < 0x80) {
+            out += static_cast<char>(c);
+        } else if (c < 0x800) {
+            out += static_cast<char>(0xc0 | (c >> 6));
+            out += static_cast<char>(0x80 | (c & 0x3f));
+        } else if (c < 0x10000) {
+            out += static_cast<char>(0xe0 | (c >> 12));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (c & 0x3f));
+        } else {
+            out += static_cast<char>(0xf0 | (c >> 18));
+            out += static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (c & 0x3f));
+        }
+    }
+    return out;
+}
+
+static string convert(wstring_view s)
+{
+    vector<char> out;
+    utf8::append(s, out);
+    return string(out.begin(), out.end());
+}
+
+// U+1F3B5, a pair in UTF-16
+static wstring musicalNote()
+{
+    return wide_is_utf16 ? wstring{ static_cast<wchar_t>(0xd83c), static_cast<wchar_t>(0xdfb5) }
+        : wstring(1, static_cast<wchar_t>(0x1f3b5));
+}
+
+static void testKnown()
+{
+    CHECK(convert(L"") == "");
+    CHECK(convert(L"Song.mp3") == "Song.mp3");
+    CHECK(convert(L"Caf\u00e9") == "Caf\xc3\xa9");
+    CHECK(convert(L"\u20ac") == "\xe2\x82\xac");
+    CHECK(convert(musicalNote()) == "\xf0\x9f\x8e\xb5");
+
+    // unpaired surrogates
+    CHECK(convert(wstring(1, static_cast<wchar_t>(0xd800))) == "\xef\xbf\xbd");
+    CHECK(convert(wstring(1, static_cast<wchar_t>(0xdc00)) + L"a") == "\xef\xbf\xbd" "a");
+
+    // appends rather than replaces
+    string s = "x";
+    utf8::append(L"y", s);
+    CHECK(s == "xy");
+}
+
+// one odd character at every position of runs of ASCII, so it lands in
+// and around every SIMD block
+static void testAgainstReference()
+{
+    const wstring odd[] = { L"\u00e9", L"\u20ac", musicalNote(), wstring(1, static_cast<wchar_t>(0xdbff)) };
+
+    for (size_t len = 0; len <= 80; ++len) {
+        wstring ascii(len, L'a');
+        CHECK(convert(ascii) == reference(ascii));
+
+        for (auto const& o : odd) {
+            for (size_t pos = 0; pos <= len; ++pos) {
+                wstring s = ascii;
+                s.insert(pos, o);
+                if (convert(s) != reference(s)) {
+                    fprintf(stderr, "length %zu, odd character at %zu\n", len, pos);
+                    CHECK(false);
+                }
+            }
+        }
+    }
+}
+
+// renderPlaylist reserves maxBytes plus the line break for each filename
+static void testNoReallocation()
+{
+    vector<wstring> names = {
+        L"01 Plain ASCII Name.mp3",
+        wstring(40, static_cast<wchar_t>(0x20ac)), // three bytes each, the worst in UTF-16
+        L"M\u00fcller - Caf\u00e9.m4a",
+        wstring(200, L'x'),
+    };
+    for (int i = 0; i < 20; ++i)
+        names.back() += musicalNote();
+    if (!wide_is_utf16)
+        names.push_back(wstring(40, static_cast<wchar_t>(0x10ffff))); // four bytes each
+
+    size_t size = 0;
+    for (auto const& name : names)
+        size += utf8::maxBytes(name.length()) + 2;
+
+    vector<char> data;
+    data.reserve(size);
+    auto before = data.data();
+    auto capacity = data.capacity();
+
+    string expected;
+    for (auto const& name : names) {
+        utf8::append(name, data);
+        data.push_back('\r');
+        data.push_back('\n');
+        expected += reference(name) + "\r\n";
+    }
+
+    CHECK(data.data() == before);
+    CHECK(data.capacity() == capacity);
+    CHECK(string(data.begin(), data.end()) == expected);
+}
+
+int main()
+{
+    testKnown();
+    testAgainstReference();
+    testNoReallocation();
+
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    else
+        printf("all utf8 checks passed\n");
+
+    return failures ? 1 : 0;
+}